@@ -0,0 +1,459 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+// End-to-end Hierarchy throughput benchmark. Builds a hierarchy with prediction inputs fed by synthetic
+// CSDR waves and action inputs fed back from its own actions, then steps it with and without learning.
+// Thread counts 1, 2, 4, ... up to --max-threads are swept twice: strong scaling keeps the hierarchy fixed,
+// weak scaling grows the columns of every layer with the number of threads. With --pipelined every run is repeated
+// with stepPipelined, which updates the layers concurrently.
+// --check-deferred only checks that deferred learning (stepDeferred + learnDeferred, stepBudgeted with an unlimited budget
+// and AsyncLearner) learns the same weights as step (exit code 1 if not).
+// Results are written as JSON (stdout or --output), progress goes to stderr.
+//
+// Usage: HierarchyBenchmark [--layers n] [--hidden-size side z] [--input-size side z] [--prediction-inputs n]
+//     [--action-inputs n] [--steps n] [--warmup n] [--max-threads n] [--pipelined] [--output file] [--check-deferred]
+
+#include <ogmaneo/Hierarchy.h>
+#include <ogmaneo/AsyncLearner.h>
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+using namespace ogmaneo;
+
+struct BenchmarkConfig {
+    int numLayers;
+    int hiddenSide; // Hidden columns per side (strong scaling, and weak scaling at 1 thread)
+    int hiddenZ;
+    int inputSide; // Input columns per side
+    int inputZ;
+    int numPredictionInputs;
+    int numActionInputs;
+    int steps; // Measured steps per run
+    int warmup; // Unmeasured steps before each run
+    int maxThreads;
+    bool pipelined; // Also run with stepPipelined
+};
+
+struct MemoryFootprint {
+    MemoryUsage usage; // Hierarchy::memoryUsage after the run
+    MemoryUsage estimate; // Hierarchy::estimateMemoryUsage
+    long long residentBytes; // Process resident set after the run, 0 where unsupported
+};
+
+struct RunResult {
+    std::string scaling;
+    int threads;
+    bool learnEnabled;
+    bool pipelined;
+    Int3 inputSize;
+    Int3 hiddenSize;
+    int steps;
+    double seconds;
+    LatencySummary latency;
+    MemoryFootprint memory;
+};
+
+long long residentBytes() {
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+
+    long long size = 0;
+    long long resident = 0;
+
+    if (statm >> size >> resident)
+        return resident * sysconf(_SC_PAGESIZE);
+#endif
+
+    return 0;
+}
+
+// Wave of a prediction input at time t, one active cell per column
+void waveCs(
+    int input,
+    int t,
+    const Int3 &size,
+    IntBuffer &cs
+) {
+    float frequency = 0.05f * (input + 1);
+
+    for (int x = 0; x < size.x; x++)
+        for (int y = 0; y < size.y; y++) {
+            float phase = 0.3f * x + 0.2f * y + input;
+
+            float v = std::sin(t * frequency + phase) * 0.5f + 0.5f;
+
+            cs[address2(Int2(x, y), Int2(size.x, size.y))] = std::min(size.z - 1, static_cast<int>(v * size.z));
+        }
+}
+
+RunResult run(
+    const BenchmarkConfig &config,
+    const std::string &scaling,
+    int threads,
+    float sizeScale, // Scale of columns per side
+    bool learnEnabled,
+    bool pipelined
+) {
+    ComputeSystem::setNumThreads(threads);
+
+    ComputeSystem cs;
+    cs.rng.seed(1234);
+
+    int inputSide = std::max(1, static_cast<int>(std::round(config.inputSide * sizeScale)));
+    int hiddenSide = std::max(1, static_cast<int>(std::round(config.hiddenSide * sizeScale)));
+
+    Int3 inputSize(inputSide, inputSide, config.inputZ);
+    Int3 hiddenSize(hiddenSide, hiddenSide, config.hiddenZ);
+
+    int numInputs = config.numPredictionInputs + config.numActionInputs;
+
+    std::vector<Int3> inputSizes(numInputs, inputSize);
+    std::vector<InputType> inputTypes(numInputs, prediction);
+
+    for (int i = config.numPredictionInputs; i < numInputs; i++)
+        inputTypes[i] = action;
+
+    std::vector<Hierarchy::LayerDesc> layerDescs(config.numLayers);
+
+    for (int l = 0; l < config.numLayers; l++)
+        layerDescs[l].hiddenSize = hiddenSize;
+
+    Hierarchy h;
+
+    h.initRandom(cs, inputSizes, inputTypes, layerDescs);
+
+    RunResult result;
+    result.scaling = scaling;
+    result.threads = threads;
+    result.learnEnabled = learnEnabled;
+    result.pipelined = pipelined;
+    result.inputSize = inputSize;
+    result.hiddenSize = hiddenSize;
+    result.steps = config.steps;
+
+    result.memory.estimate = Hierarchy::estimateMemoryUsage(inputSizes, inputTypes, layerDescs);
+
+    std::vector<IntBuffer> inputCs(numInputs, IntBuffer(inputSize.x * inputSize.y, 0));
+    std::vector<const IntBuffer*> inputCsPtrs(numInputs);
+
+    for (int i = 0; i < numInputs; i++)
+        inputCsPtrs[i] = &inputCs[i];
+
+    StepLatencies latencies;
+
+    std::chrono::steady_clock::time_point start;
+
+    for (int t = 0; t < config.warmup + config.steps; t++) {
+        if (t == config.warmup) {
+            cs.stepLatencies = &latencies;
+
+            start = std::chrono::steady_clock::now();
+        }
+
+        for (int i = 0; i < config.numPredictionInputs; i++)
+            waveCs(i, t, inputSize, inputCs[i]);
+
+        // Actions close the loop, rewarded for following the first wave
+        float reward = 0.0f;
+
+        for (int i = config.numPredictionInputs; i < numInputs; i++) {
+            inputCs[i] = h.getPredictionCs(i);
+
+            for (int j = 0; j < inputCs[i].size(); j++)
+                reward += inputCs[i][j] == inputCs[0][j] ? 1.0f : 0.0f;
+        }
+
+        if (config.numActionInputs > 0)
+            reward /= inputSize.x * inputSize.y * config.numActionInputs;
+
+        if (pipelined)
+            h.stepPipelined(cs, inputCsPtrs, learnEnabled, reward);
+        else
+            h.step(cs, inputCsPtrs, learnEnabled, reward);
+    }
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.latency = latencies.step.getSummary();
+
+    result.memory.usage = h.memoryUsage();
+    result.memory.residentBytes = residentBytes();
+
+    return result;
+}
+
+// Whether the weights of all sparse coders and predictors are equal
+bool sameWeights(
+    const Hierarchy &a,
+    const Hierarchy &b
+) {
+    for (int l = 0; l < a.getNumLayers(); l++) {
+        const SparseCoder &sc = a.getSCLayer(l);
+
+        for (int v = 0; v < sc.getNumVisibleLayers(); v++) {
+            if (sc.getVisibleLayer(v).weights.nonZeroValues != b.getSCLayer(l).getVisibleLayer(v).weights.nonZeroValues)
+                return false;
+        }
+
+        for (int p = 0; p < a.getPLayers(l).size(); p++) {
+            const Predictor* predictor = a.getPLayers(l)[p].get();
+
+            if (predictor == nullptr)
+                continue;
+
+            for (int v = 0; v < predictor->getNumVisibleLayers(); v++) {
+                if (predictor->getVisibleLayer(v).weights.nonZeroValues != b.getPLayers(l)[p]->getVisibleLayer(v).weights.nonZeroValues)
+                    return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Step copies of one hierarchy with step and with each form of deferred learning, inputs of different sizes.
+// Only a single step is compared each time: later deferred steps activate predictors before learning (one step stale)
+bool checkDeferred() {
+    ComputeSystem cs;
+    cs.rng.seed(1234);
+
+    std::vector<Int3> inputSizes = { Int3(2, 2, 8), Int3(8, 8, 8) };
+    std::vector<InputType> inputTypes(inputSizes.size(), prediction);
+
+    std::vector<Hierarchy::LayerDesc> layerDescs(2);
+
+    for (int l = 0; l < layerDescs.size(); l++)
+        layerDescs[l].temporalHorizon = 2;
+
+    Hierarchy h;
+
+    h.initRandom(cs, inputSizes, inputTypes, layerDescs);
+
+    std::vector<IntBuffer> inputCs(inputSizes.size());
+    std::vector<const IntBuffer*> inputCsPtrs(inputSizes.size());
+
+    for (int i = 0; i < inputSizes.size(); i++) {
+        inputCs[i].resize(inputSizes[i].x * inputSizes[i].y);
+
+        inputCsPtrs[i] = &inputCs[i];
+    }
+
+    for (int t = 0; t < 20; t++) {
+        for (int i = 0; i < inputSizes.size(); i++)
+            waveCs(i, t, inputSizes[i], inputCs[i]);
+
+        Hierarchy deferred = h;
+        Hierarchy budgeted = h;
+        Hierarchy async = h;
+        ComputeSystem deferredCS = cs;
+        ComputeSystem budgetedCS = cs;
+        ComputeSystem asyncCS = cs;
+
+        h.step(cs, inputCsPtrs, true);
+
+        deferred.stepDeferred(deferredCS, inputCsPtrs);
+        deferred.learnDeferred(deferredCS);
+
+        budgeted.stepBudgeted(budgetedCS, inputCsPtrs, 1000.0f);
+
+        {
+            AsyncLearner learner;
+
+            learner.step(asyncCS, async, inputCsPtrs);
+            learner.wait();
+        }
+
+        const Hierarchy* checked[] = { &deferred, &budgeted, &async };
+        const char* names[] = { "stepDeferred + learnDeferred", "stepBudgeted", "AsyncLearner" };
+
+        for (int c = 0; c < 3; c++) {
+            if (!sameWeights(h, *checked[c])) {
+                std::cerr << names[c] << " differs from step at step " << t << std::endl;
+
+                return false;
+            }
+        }
+    }
+
+    std::cerr << "Deferred learning matches step" << std::endl;
+
+    return true;
+}
+
+void writeSize(
+    std::ostream &os,
+    const Int3 &size
+) {
+    os << "[" << size.x << "," << size.y << "," << size.z << "]";
+}
+
+void writeMemoryUsage(
+    std::ostream &os,
+    const MemoryUsage &usage
+) {
+    os << "{\"weights\":" << usage.weights << ",\"topology\":" << usage.topology << ",\"transpose\":" << usage.transpose
+        << ",\"states\":" << usage.states << ",\"histories\":" << usage.histories << ",\"replay\":" << usage.replay
+        << ",\"other\":" << usage.other << ",\"total\":" << usage.total() << "}";
+}
+
+void writeResult(
+    std::ostream &os,
+    const RunResult &r
+) {
+    os << "{\"scaling\":\"" << r.scaling << "\",\"threads\":" << r.threads << ",\"learnEnabled\":" << (r.learnEnabled ? "true" : "false")
+        << ",\"pipelined\":" << (r.pipelined ? "true" : "false");
+    os << ",\"inputSize\":";
+    writeSize(os, r.inputSize);
+    os << ",\"hiddenSize\":";
+    writeSize(os, r.hiddenSize);
+    os << ",\"steps\":" << r.steps << ",\"seconds\":" << r.seconds << ",\"stepsPerSecond\":" << r.steps / r.seconds;
+    os << ",\"latency\":{\"mean\":" << r.latency.mean << ",\"min\":" << r.latency.min << ",\"p50\":" << r.latency.p50
+        << ",\"p90\":" << r.latency.p90 << ",\"p99\":" << r.latency.p99 << ",\"p999\":" << r.latency.p999 << ",\"max\":" << r.latency.max << "}";
+    os << ",\"memory\":{\"usage\":";
+    writeMemoryUsage(os, r.memory.usage);
+    os << ",\"estimate\":";
+    writeMemoryUsage(os, r.memory.estimate);
+    os << ",\"residentBytes\":" << r.memory.residentBytes << "}}";
+}
+
+int main(
+    int argc,
+    char** argv
+) {
+    BenchmarkConfig config;
+    config.numLayers = 3;
+    config.hiddenSide = 8;
+    config.hiddenZ = 16;
+    config.inputSide = 8;
+    config.inputZ = 16;
+    config.numPredictionInputs = 2;
+    config.numActionInputs = 1;
+    config.steps = 500;
+    config.warmup = 50;
+    config.maxThreads = omp_get_max_threads();
+    config.pipelined = false;
+
+    std::string outputName;
+
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--layers") == 0 && i + 1 < argc)
+            config.numLayers = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--hidden-size") == 0 && i + 2 < argc) {
+            config.hiddenSide = std::atoi(argv[++i]);
+            config.hiddenZ = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--input-size") == 0 && i + 2 < argc) {
+            config.inputSide = std::atoi(argv[++i]);
+            config.inputZ = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--prediction-inputs") == 0 && i + 1 < argc)
+            config.numPredictionInputs = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--action-inputs") == 0 && i + 1 < argc)
+            config.numActionInputs = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--steps") == 0 && i + 1 < argc)
+            config.steps = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+            config.warmup = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--max-threads") == 0 && i + 1 < argc)
+            config.maxThreads = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--pipelined") == 0)
+            config.pipelined = true;
+        else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            outputName = argv[++i];
+        else if (std::strcmp(argv[i], "--check-deferred") == 0)
+            return checkDeferred() ? 0 : 1;
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--layers n] [--hidden-size side z] [--input-size side z] [--prediction-inputs n]"
+                " [--action-inputs n] [--steps n] [--warmup n] [--max-threads n] [--pipelined] [--output file] [--check-deferred]" << std::endl;
+
+            return 1;
+        }
+    }
+
+    if (config.numLayers < 1 || config.hiddenSide < 1 || config.hiddenZ < 1 || config.inputSide < 1 || config.inputZ < 1 ||
+        config.numPredictionInputs < 1 || config.numActionInputs < 0 || config.steps < 1 || config.warmup < 0 || config.maxThreads < 1) {
+        std::cerr << "Invalid configuration" << std::endl;
+
+        return 1;
+    }
+
+    // 1, 2, 4, ... and maxThreads
+    std::vector<int> threadCounts;
+
+    for (int t = 1; t < config.maxThreads; t *= 2)
+        threadCounts.push_back(t);
+
+    threadCounts.push_back(config.maxThreads);
+
+    std::vector<RunResult> results;
+
+    for (int s = 0; s < 2; s++) {
+        bool weak = s == 1;
+
+        for (int ti = 0; ti < threadCounts.size(); ti++) {
+            int threads = threadCounts[ti];
+
+            // Weak scaling keeps columns per thread constant
+            float sizeScale = weak ? std::sqrt(static_cast<float>(threads)) : 1.0f;
+
+            for (int pipelined = 0; pipelined <= (config.pipelined ? 1 : 0); pipelined++) {
+                for (int learn = 1; learn >= 0; learn--) {
+                    results.push_back(run(config, weak ? "weak" : "strong", threads, sizeScale, learn == 1, pipelined == 1));
+
+                    const RunResult &r = results.back();
+
+                    std::cerr << r.scaling << " threads=" << r.threads << " learn=" << r.learnEnabled << " pipelined=" << r.pipelined
+                        << " steps/s=" << r.steps / r.seconds << " p99=" << r.latency.p99 * 1000.0 << "ms" << std::endl;
+                }
+            }
+        }
+    }
+
+    std::ofstream file;
+
+    if (!outputName.empty()) {
+        file.open(outputName);
+
+        if (!file.is_open()) {
+            std::cerr << "Could not open " << outputName << std::endl;
+
+            return 1;
+        }
+    }
+
+    std::ostream &os = outputName.empty() ? std::cout : file;
+
+    os << std::setprecision(9);
+
+    os << "{\"benchmark\":\"Hierarchy\",\"config\":{\"layers\":" << config.numLayers
+        << ",\"hiddenSide\":" << config.hiddenSide << ",\"hiddenZ\":" << config.hiddenZ
+        << ",\"inputSide\":" << config.inputSide << ",\"inputZ\":" << config.inputZ
+        << ",\"predictionInputs\":" << config.numPredictionInputs << ",\"actionInputs\":" << config.numActionInputs
+        << ",\"steps\":" << config.steps << ",\"warmup\":" << config.warmup << ",\"maxThreads\":" << config.maxThreads
+        << ",\"pipelined\":" << (config.pipelined ? "true" : "false") << "},\"results\":[";
+
+    for (int i = 0; i < results.size(); i++) {
+        os << (i == 0 ? "\n" : ",\n");
+
+        writeResult(os, results[i]);
+    }
+
+    os << "\n]}" << std::endl;
+
+    return os.good() ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+// Microbenchmarks of SparseMatrix kernels on local receptive field matrices like the ones layers use:
+// a visible layer of size x size columns with z cells each, seen by a hidden layer of the same columns with hidden z cells each.
+// Per row/column kernels run single threaded over all rows (or columns) of a matrix, one call is one op.
+// Bytes and flops are estimates from the values and indices each kernel reads and writes.
+// Layers whose matrix would exceed --max-nonzeros are measured on a square tile of their columns instead (the tile column),
+// interior rows and columns of a tile have the same receptive fields as in the full layer. Whole matrix ops then cover the tile.
+//
+// Usage: SparseMatrixBenchmark [--min-time seconds] [--max-nonzeros count] [--filter op]
+
+#include <ogmaneo/Helpers.h>
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+
+using namespace ogmaneo;
+
+struct BenchmarkCase {
+    int size; // Columns per side (visible and hidden) of the layer
+    int tile; // Columns per side actually allocated, at most size
+    int z; // Cells per visible column
+    int hiddenZ; // Cells per hidden column
+    int radius;
+};
+
+struct BenchmarkOp {
+    std::string name;
+    long long opsPerPass; // Kernel calls per pass
+    double bytesPerPass;
+    double flopsPerPass;
+    std::function<void()> pass;
+};
+
+// Keeps results alive so passes are not optimized away
+volatile float benchmarkSink = 0.0f;
+
+// Run passes until minSeconds have passed (at least one), returns seconds per pass
+double timePasses(
+    const std::function<void()> &pass,
+    double minSeconds
+) {
+    // Warm up caches and page in memory
+    pass();
+
+    int passes = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    double elapsed = 0.0;
+
+    do {
+        pass();
+
+        passes++;
+
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < minSeconds);
+
+    return elapsed / passes;
+}
+
+void runCase(
+    const BenchmarkCase &c,
+    double minSeconds,
+    const std::string &filter
+) {
+    Int3 visibleSize(c.tile, c.tile, c.z);
+    Int3 hiddenSize(c.tile, c.tile, c.hiddenZ);
+
+    std::mt19937 rng(c.size * 100000 + c.z * 1000 + c.hiddenZ * 10 + c.radius);
+
+    // Rows are hidden cells, columns visible cells
+    SparseMatrix mat;
+
+    initSMLocalRF(visibleSize, hiddenSize, c.radius, mat);
+    initSMUniform(rng, -0.01f, 0.01f, mat);
+
+    mat.initT();
+
+    int hiddenZ = c.hiddenZ;
+
+    int numColumns = c.tile * c.tile;
+    int numVisible = numColumns * c.z;
+    int numHidden = numColumns * hiddenZ;
+    double nonZeros = mat.nonZeroValues.size();
+
+    // One-hot kernels visit one entry per visible column (rows) or hidden column (transpose)
+    double visited = nonZeros / c.z;
+    double visitedT = nonZeros / hiddenZ;
+
+    std::uniform_int_distribution<int> visibleDist(0, c.z - 1);
+    std::uniform_int_distribution<int> hiddenDist(0, hiddenZ - 1);
+    std::uniform_real_distribution<float> valueDist(0.0f, 1.0f);
+
+    IntBuffer visibleCs(numColumns);
+    IntBuffer hiddenCs(numColumns);
+    IntBuffer hiddenCsPrev(numColumns);
+
+    for (int i = 0; i < numColumns; i++) {
+        visibleCs[i] = visibleDist(rng);
+        hiddenCs[i] = hiddenDist(rng);
+        hiddenCsPrev[i] = (hiddenCs[i] + 1) % hiddenZ; // All changed
+    }
+
+    FloatBuffer dense(numVisible);
+
+    for (int i = 0; i < numVisible; i++)
+        dense[i] = valueDist(rng);
+
+    std::vector<BenchmarkOp> ops;
+
+    ops.push_back({ "multiplyOHVs", numHidden, visited * 12.0, visited, [&]() {
+        float sum = 0.0f;
+
+        for (int i = 0; i < numHidden; i++)
+            sum += mat.multiplyOHVs(visibleCs, i, c.z);
+
+        benchmarkSink = sum;
+    } });
+
+    ops.push_back({ "multiplyOHVsT", numVisible, visitedT * 16.0, visitedT, [&]() {
+        float sum = 0.0f;
+
+        for (int j = 0; j < numVisible; j++)
+            sum += mat.multiplyOHVsT(hiddenCs, j, hiddenZ);
+
+        benchmarkSink = sum;
+    } });
+
+    ops.push_back({ "deltaOHVs", numHidden, visited * 16.0, visited, [&]() {
+        for (int i = 0; i < numHidden; i++)
+            mat.deltaOHVs(visibleCs, 1e-6f, i, c.z);
+    } });
+
+    ops.push_back({ "deltaChangedOHVsT", numVisible, visitedT * 24.0, visitedT, [&]() {
+        for (int j = 0; j < numVisible; j++)
+            mat.deltaChangedOHVsT(hiddenCs, hiddenCsPrev, 1e-6f, j, hiddenZ);
+    } });
+
+    ops.push_back({ "distance2", numHidden, nonZeros * 12.0, nonZeros * 3.0, [&]() {
+        float sum = 0.0f;
+
+        for (int i = 0; i < numHidden; i++)
+            sum += mat.distance2(dense, i);
+
+        benchmarkSink = sum;
+    } });
+
+    ops.push_back({ "hebb", numHidden, nonZeros * 16.0, nonZeros * 3.0, [&]() {
+        for (int i = 0; i < numHidden; i++)
+            mat.hebb(dense, i, 1e-6f);
+    } });
+
+    // Whole matrix operations, one op per pass
+    ops.push_back({ "initT", 1, nonZeros * 20.0, 0.0, [&]() {
+        mat.initT();
+    } });
+
+    // Regenerates the benchmarked matrix in place (last op), so large cases do not need a second matrix
+    ops.push_back({ "initSMLocalRF", 1, nonZeros * 8.0, 0.0, [&]() {
+        initSMLocalRF(visibleSize, hiddenSize, c.radius, mat);
+
+        benchmarkSink = mat.nonZeroValues.size();
+    } });
+
+    for (int i = 0; i < ops.size(); i++) {
+        const BenchmarkOp &op = ops[i];
+
+        if (!filter.empty() && op.name.find(filter) == std::string::npos)
+            continue;
+
+        double seconds = timePasses(op.pass, minSeconds);
+
+        std::cout << std::left << std::setw(19) << op.name
+            << std::setw(13) << (std::to_string(c.size) + "x" + std::to_string(c.size) + "x" + std::to_string(c.z))
+            << std::right << std::setw(4) << c.hiddenZ
+            << std::setw(3) << c.radius
+            << std::setw(6) << c.tile
+            << std::setw(13) << static_cast<long long>(nonZeros)
+            << std::setw(14) << seconds / op.opsPerPass * 1e9
+            << std::setw(10) << op.bytesPerPass / seconds * 1e-9;
+
+        if (op.flopsPerPass > 0.0)
+            std::cout << std::setw(10) << op.flopsPerPass / seconds * 1e-9;
+        else
+            std::cout << std::setw(10) << "-";
+
+        std::cout << std::endl;
+    }
+}
+
+int main(
+    int argc,
+    char** argv
+) {
+    double minSeconds = 0.2;
+    double maxNonZeros = 160.0 * 1024.0 * 1024.0; // Largest matrix (by values) to allocate, about 16 bytes each with the transpose
+    std::string filter;
+
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+            minSeconds = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--max-nonzeros") == 0 && i + 1 < argc)
+            maxNonZeros = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            filter = argv[++i];
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--min-time seconds] [--max-nonzeros count] [--filter op]" << std::endl;
+
+            return 1;
+        }
+    }
+
+    const int sizes[] = { 16, 64, 256 };
+    const int zs[] = { 16, 64, 256 };
+    const int radii[] = { 1, 2, 3, 4 };
+
+    std::cout << std::fixed << std::setprecision(2);
+
+    std::cout << "op                 shape          hz  r  tile     nonzeros         ns/op      GB/s   GFLOP/s" << std::endl;
+
+    for (int s = 0; s < 3; s++)
+        for (int z = 0; z < 3; z++)
+            for (int hz = 0; hz < 3; hz++)
+                for (int r = 0; r < 4; r++) {
+                    BenchmarkCase c{ sizes[s], sizes[s], zs[z], zs[hz], radii[r] };
+
+                    // Upper bound per hidden column (no clamping at borders)
+                    int diam = c.radius * 2 + 1;
+                    double columnNonZeros = static_cast<double>(c.hiddenZ) * diam * diam * c.z;
+
+                    // Largest tile within the limit
+                    while (c.tile > 1 && columnNonZeros * c.tile * c.tile > maxNonZeros)
+                        c.tile--;
+
+                    // A tile needs at least one interior column with a complete receptive field
+                    if (columnNonZeros * c.tile * c.tile > maxNonZeros || c.tile < std::min(c.size, diam)) {
+                        std::cout << "skipped " << c.size << "x" << c.size << "x" << c.z << " hz" << c.hiddenZ << " r" << c.radius
+                            << " (" << static_cast<long long>(columnNonZeros * diam * diam) << " nonzeros in the smallest tile, raise --max-nonzeros)" << std::endl;
+
+                        continue;
+                    }
+
+                    runCase(c, minSeconds, filter);
+                }
+
+    return 0;
+}
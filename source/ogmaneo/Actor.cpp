@@ -10,11 +10,18 @@
 
 using namespace ogmaneo;
 
+// Stream layout version, written negated in place of hiddenSize.x (always positive in unversioned streams).
+// 0: unversioned (no priorities or compression), 2: priorities, history compression
+static const int actorStreamVersion = 2;
+
 void Actor::forward(
     const Int2 &pos,
     std::mt19937 &rng,
-    const std::vector<const IntBuffer*> &inputCs
-) {
+    const std::vector<const IntBuffer*> &inputCs,
+    IntBuffer* hiddenCsOut,
+    FloatBuffer* hiddenValuesOut,
+    FloatBuffer* hiddenActivationsOut
+) const {
     int hiddenColumnIndex = address2(pos, Int2(hiddenSize.x, hiddenSize.y));
 
     // --- Value ---
@@ -24,14 +31,14 @@ void Actor::forward(
 
     // For each visible layer
     for (int vli = 0; vli < visibleLayers.size(); vli++) {
-        VisibleLayer &vl = visibleLayers[vli];
+        const VisibleLayer &vl = visibleLayers[vli];
         const VisibleLayerDesc &vld = visibleLayerDescs[vli];
 
         value += vl.valueWeights.multiplyOHVs(*inputCs[vli], hiddenColumnIndex, vld.size.z);
         count += vl.valueWeights.count(hiddenColumnIndex) / vld.size.z;
     }
 
-    hiddenValues[hiddenColumnIndex] = value / count;
+    (*hiddenValuesOut)[hiddenColumnIndex] = value / count;
 
     // --- Action ---
 
@@ -44,7 +51,7 @@ void Actor::forward(
 
         // For each visible layer
         for (int vli = 0; vli < visibleLayers.size(); vli++) {
-            VisibleLayer &vl = visibleLayers[vli];
+            const VisibleLayer &vl = visibleLayers[vli];
             const VisibleLayerDesc &vld = visibleLayerDescs[vli];
 
             sum += vl.actionWeights.multiplyOHVs(*inputCs[vli], hiddenIndex, vld.size.z);
@@ -52,7 +59,7 @@ void Actor::forward(
 
         sum /= count;
 
-        hiddenActivations[hiddenIndex] = sum;
+        (*hiddenActivationsOut)[hiddenIndex] = sum;
 
         maxActivation = std::max(maxActivation, sum);
     }
@@ -62,9 +69,9 @@ void Actor::forward(
     for (int hc = 0; hc < hiddenSize.z; hc++) {
         int hiddenIndex = address3(Int3(pos.x, pos.y, hc), hiddenSize);
 
-        hiddenActivations[hiddenIndex] = std::exp(hiddenActivations[hiddenIndex] - maxActivation);
+        (*hiddenActivationsOut)[hiddenIndex] = std::exp((*hiddenActivationsOut)[hiddenIndex] - maxActivation);
         
-        total += hiddenActivations[hiddenIndex];
+        total += (*hiddenActivationsOut)[hiddenIndex];
     }
 
     std::uniform_real_distribution<float> cuspDist(0.0f, total);
@@ -77,7 +84,7 @@ void Actor::forward(
     for (int hc = 0; hc < hiddenSize.z; hc++) {
         int hiddenIndex = address3(Int3(pos.x, pos.y, hc), hiddenSize);
 
-        sumSoFar += hiddenActivations[hiddenIndex];
+        sumSoFar += (*hiddenActivationsOut)[hiddenIndex];
 
         if (sumSoFar >= cusp) {
             selectIndex = hc;
@@ -86,7 +93,7 @@ void Actor::forward(
         }
     }
     
-    hiddenCs[hiddenColumnIndex] = selectIndex;
+    (*hiddenCsOut)[hiddenColumnIndex] = selectIndex;
 }
 
 void Actor::learn(
@@ -97,6 +104,7 @@ void Actor::learn(
     const FloatBuffer* hiddenValuesPrev,
     float q,
     float g,
+    float importance,
     bool mimic
 ) {
     int hiddenColumnIndex = address2(pos, Int2(hiddenSize.x, hiddenSize.y));
@@ -120,8 +128,10 @@ void Actor::learn(
     value /= count;
 
     float tdErrorValue = newValue - value;
+
+    hiddenTDErrors[hiddenColumnIndex] = std::abs(tdErrorValue);
     
-    float deltaValue = alpha * tdErrorValue;
+    float deltaValue = alpha * importance * tdErrorValue;
 
     // For each visible layer
     for (int vli = 0; vli < visibleLayers.size(); vli++) {
@@ -172,7 +182,7 @@ void Actor::learn(
     for (int hc = 0; hc < hiddenSize.z; hc++) {
         int hiddenIndex = address3(Int3(pos.x, pos.y, hc), hiddenSize);
 
-        float deltaAction = (mimic ? beta : (tdErrorAction > 0.0f ? beta : -beta)) * ((hc == targetC ? 1.0f : 0.0f) - hiddenActivations[hiddenIndex] / std::max(0.0001f, total));
+        float deltaAction = importance * (mimic ? beta : (tdErrorAction > 0.0f ? beta : -beta)) * ((hc == targetC ? 1.0f : 0.0f) - hiddenActivations[hiddenIndex] / std::max(0.0001f, total));
 
         // For each visible layer
         for (int vli = 0; vli < visibleLayers.size(); vli++) {
@@ -184,12 +194,80 @@ void Actor::learn(
     }
 }
 
+void Actor::initHistory(
+    int historyCapacity
+) {
+    int numHiddenColumns = hiddenSize.x * hiddenSize.y;
+
+    // Create (pre-allocated) history samples
+    historySize = 0;
+    historyPushes = std::numeric_limits<int>::max();
+    historySamples.resize(historyCapacity);
+
+    for (int i = 0; i < historySamples.size(); i++) {
+        historySamples[i].inputCs.resize(visibleLayers.size());
+
+        // Only the front sample holds data when compressing
+        if (compressHistory && i != historySamples.start)
+            continue;
+
+        for (int vli = 0; vli < visibleLayers.size(); vli++) {
+            VisibleLayerDesc &vld = visibleLayerDescs[vli];
+
+            int numVisibleColumns = vld.size.x * vld.size.y;
+
+            historySamples[i].inputCs[vli] = IntBuffer(numVisibleColumns);
+        }
+
+        historySamples[i].hiddenTargetCsPrev = IntBuffer(numHiddenColumns);
+
+        historySamples[i].hiddenValuesPrev = FloatBuffer(numHiddenColumns);
+    }
+
+    if (compressHistory) {
+        compressedSamples.resize(historyCapacity);
+        compressedSamples.start = historySamples.start;
+
+        for (int i = 0; i < compressedSamples.size(); i++) {
+            compressedSamples[i].inputCs.resize(visibleLayers.size());
+            compressedSamples[i].hiddenValuesPrev = std::vector<unsigned short>(numHiddenColumns, 0);
+            compressedSamples[i].key = false;
+        }
+    }
+    else
+        compressedSamples = CircleBuffer<CompressedHistorySample>();
+
+    maxPriority = 1.0f;
+    historyPriorities = FloatBuffer(historyCapacity, maxPriority);
+
+    rebuildPriorityTree();
+}
+
+KernelShape Actor::getHiddenShape(
+    KernelClass kernelClass
+) const {
+    int numHiddenColumns = hiddenSize.x * hiddenSize.y;
+
+    int radius = 0;
+    int numWeights = 0;
+
+    for (int vli = 0; vli < visibleLayers.size(); vli++) {
+        radius = std::max(radius, visibleLayerDescs[vli].radius);
+        numWeights += visibleLayers[vli].valueWeights.nonZeroValues.size() + visibleLayers[vli].actionWeights.nonZeroValues.size();
+    }
+
+    return KernelShape(kernelClass, hiddenSize, radius, numWeights / numHiddenColumns);
+}
+
 void Actor::initRandom(
     ComputeSystem &cs,
     const Int3 &hiddenSize,
     int historyCapacity,
-    const std::vector<VisibleLayerDesc> &visibleLayerDescs
+    const std::vector<VisibleLayerDesc> &visibleLayerDescs,
+    bool compressHistory
 ) {
+    hiddenPartition = KernelPartition();
+
     this->visibleLayerDescs = visibleLayerDescs;
 
     this->hiddenSize = hiddenSize;
@@ -200,22 +278,17 @@ void Actor::initRandom(
     int numHiddenColumns = hiddenSize.x * hiddenSize.y;
     int numHidden = numHiddenColumns * hiddenSize.z;
 
-    std::uniform_real_distribution<float> weightDist(-0.01f, 0.01f);
-
     // Create layers
     for (int vli = 0; vli < visibleLayers.size(); vli++) {
         VisibleLayer &vl = visibleLayers[vli];
         VisibleLayerDesc &vld = this->visibleLayerDescs[vli];
 
         // Create weight matrix for this visible layer and initialize randomly
-        initSMLocalRF(vld.size, Int3(hiddenSize.x, hiddenSize.y, 1), vld.radius, vl.valueWeights);
-        initSMLocalRF(vld.size, hiddenSize, vld.radius, vl.actionWeights);
+        initSMLocalRF(cs, vld.size, Int3(hiddenSize.x, hiddenSize.y, 1), vld.radius, false, vl.valueWeights);
+        initSMLocalRF(cs, vld.size, hiddenSize, vld.radius, false, vl.actionWeights);
 
-        for (int i = 0; i < vl.valueWeights.nonZeroValues.size(); i++)
-            vl.valueWeights.nonZeroValues[i] = weightDist(cs.rng);
-
-        for (int i = 0; i < vl.actionWeights.nonZeroValues.size(); i++)
-            vl.actionWeights.nonZeroValues[i] = weightDist(cs.rng);
+        initSMUniform(cs.rng, -0.01f, 0.01f, vl.valueWeights);
+        initSMUniform(cs.rng, -0.01f, 0.01f, vl.actionWeights);
     }
 
     hiddenActivations = FloatBuffer(numHidden, 0.0f);
@@ -224,25 +297,168 @@ void Actor::initRandom(
 
     hiddenValues = FloatBuffer(numHiddenColumns, 0.0f);
 
-    // Create (pre-allocated) history samples
-    historySize = 0;
-    historySamples.resize(historyCapacity);
+    hiddenTDErrors = FloatBuffer(numHiddenColumns, 0.0f);
 
-    for (int i = 0; i < historySamples.size(); i++) {
-        historySamples[i].inputCs.resize(visibleLayers.size());
+    this->compressHistory = compressHistory;
 
-        for (int vli = 0; vli < visibleLayers.size(); vli++) {
-            VisibleLayerDesc &vld = this->visibleLayerDescs[vli];
+    initHistory(historyCapacity);
+}
 
-            int numVisibleColumns = vld.size.x * vld.size.y;
+// Store the (index, value) pairs where src differs from next
+static void encodeDelta(
+    const IntBuffer &src,
+    const IntBuffer &next,
+    IntBuffer &delta
+) {
+    delta.clear();
 
-            historySamples[i].inputCs[vli] = IntBuffer(numVisibleColumns);
+    for (int i = 0; i < src.size(); i++) {
+        if (src[i] != next[i]) {
+            delta.push_back(i);
+            delta.push_back(src[i]);
         }
+    }
+}
 
-        historySamples[i].hiddenTargetCsPrev = IntBuffer(numHiddenColumns);
+static void applyDelta(
+    const IntBuffer &delta,
+    IntBuffer &dst
+) {
+    for (int i = 0; i < delta.size(); i += 2)
+        dst[delta[i]] = delta[i + 1];
+}
 
-        historySamples[i].hiddenValuesPrev = FloatBuffer(numHiddenColumns);
+void Actor::encodeHistorySample(
+    int t,
+    const HistorySample &s,
+    const std::vector<const IntBuffer*> &inputCsNext,
+    const IntBuffer* hiddenTargetCsPrevNext
+) {
+    CompressedHistorySample &encoded = compressedSamples[t];
+
+    // Key slots are fixed in the buffer so their (full size) allocations are reused
+    int slot = (compressedSamples.start + t) % compressedSamples.size();
+
+    encoded.key = slot % std::max(1, historyKeyInterval) == 0;
+
+    for (int vli = 0; vli < visibleLayers.size(); vli++) {
+        if (encoded.key)
+            encoded.inputCs[vli] = s.inputCs[vli];
+        else
+            encodeDelta(s.inputCs[vli], *inputCsNext[vli], encoded.inputCs[vli]);
     }
+
+    if (encoded.key)
+        encoded.hiddenTargetCsPrev = s.hiddenTargetCsPrev;
+    else
+        encodeDelta(s.hiddenTargetCsPrev, *hiddenTargetCsPrevNext, encoded.hiddenTargetCsPrev);
+
+    encoded.hiddenValuesPrev.resize(s.hiddenValuesPrev.size());
+
+    for (int i = 0; i < s.hiddenValuesPrev.size(); i++)
+        encoded.hiddenValuesPrev[i] = floatToHalf(s.hiddenValuesPrev[i]);
+}
+
+void Actor::decodeHistorySample(
+    int t,
+    HistorySample &s
+) const {
+    // Find nearest newer sample that is stored in full
+    int k = t;
+
+    while (k > 0 && !compressedSamples[k].key)
+        k--;
+
+    if (k == 0) {
+        s.inputCs = historySamples[0].inputCs;
+        s.hiddenTargetCsPrev = historySamples[0].hiddenTargetCsPrev;
+    }
+    else {
+        s.inputCs = compressedSamples[k].inputCs;
+        s.hiddenTargetCsPrev = compressedSamples[k].hiddenTargetCsPrev;
+    }
+
+    // Walk back in time, patching changed columns
+    for (int j = k + 1; j <= t; j++) {
+        const CompressedHistorySample &encoded = compressedSamples[j];
+
+        for (int vli = 0; vli < visibleLayers.size(); vli++)
+            applyDelta(encoded.inputCs[vli], s.inputCs[vli]);
+
+        applyDelta(encoded.hiddenTargetCsPrev, s.hiddenTargetCsPrev);
+    }
+
+    if (t == 0)
+        s.hiddenValuesPrev = historySamples[0].hiddenValuesPrev;
+    else {
+        const CompressedHistorySample &encoded = compressedSamples[t];
+
+        s.hiddenValuesPrev.resize(encoded.hiddenValuesPrev.size());
+
+        for (int i = 0; i < encoded.hiddenValuesPrev.size(); i++)
+            s.hiddenValuesPrev[i] = halfToFloat(encoded.hiddenValuesPrev[i]);
+    }
+
+    s.reward = historySamples[t].reward;
+}
+
+void Actor::rebuildPriorityTree() {
+    priorityTree.resize(historySamples.size());
+
+    treeMinSteps = minSteps;
+
+    // Only samples that can be replayed (have a predecessor and are at least minSteps old) get sampled
+    for (int t = minSteps; t < historySize - 1; t++) {
+        int slot = (historySamples.start + t) % historySamples.size();
+
+        priorityTree.set(slot, historyPriorities[slot]);
+    }
+}
+
+void Actor::loadHistorySample(
+    int t,
+    HistorySample &s,
+    HistorySample &next
+) {
+    if (compressHistory) {
+        compressedSamples[t].inputCs.resize(visibleLayers.size());
+
+        if (t > 0) {
+            encodeHistorySample(t, s, constGet(next.inputCs), &next.hiddenTargetCsPrev);
+
+            // Only the reward is kept uncompressed
+            historySamples[t] = HistorySample();
+            historySamples[t].inputCs.resize(visibleLayers.size());
+            historySamples[t].reward = s.reward;
+
+            std::swap(next, s);
+
+            return;
+        }
+
+        next = s;
+    }
+
+    std::swap(historySamples[t], s);
+}
+
+void Actor::activate(
+    ComputeSystem &cs,
+    const std::vector<const IntBuffer*> &inputCs
+) {
+    // Forward kernel
+    runKernel2(cs, std::bind(Actor::forwardKernel, std::placeholders::_1, std::placeholders::_2, this, inputCs, &hiddenCs, &hiddenValues, &hiddenActivations), Int2(hiddenSize.x, hiddenSize.y), cs.rng, getHiddenShape(kernelAForward), getHiddenPartition(cs, *this, hiddenPartition));
+}
+
+void Actor::activate(
+    ComputeSystem &cs,
+    const std::vector<const IntBuffer*> &inputCs,
+    IntBuffer* hiddenCsOut,
+    FloatBuffer* hiddenValuesOut,
+    FloatBuffer* hiddenActivationsOut
+) const {
+    // No cost-balanced partition, it is cached in the layer
+    runKernel2(cs, std::bind(Actor::forwardKernel, std::placeholders::_1, std::placeholders::_2, this, inputCs, hiddenCsOut, hiddenValuesOut, hiddenActivationsOut), Int2(hiddenSize.x, hiddenSize.y), cs.rng, getHiddenShape(kernelAForward), nullptr);
 }
 
 void Actor::step(
@@ -255,14 +471,31 @@ void Actor::step(
 ) {
     int numHiddenColumns = hiddenSize.x * hiddenSize.y;
 
-    // Forward kernel
-    runKernel2(cs, std::bind(Actor::forwardKernel, std::placeholders::_1, std::placeholders::_2, this, inputCs), Int2(hiddenSize.x, hiddenSize.y), cs.rng, cs.batchSize2);
+    activate(cs, inputCs);
 
     historySamples.pushFront();
 
+    if (historyPushes < std::numeric_limits<int>::max())
+        historyPushes++;
+
     // If not at cap, increment
     if (historySize < historySamples.size())
         historySize++;
+
+    if (compressHistory && historySamples.size() > 1) {
+        compressedSamples.start = historySamples.start;
+
+        // Previous front becomes compressed against the new sample
+        HistorySample &sPrevFront = historySamples[1];
+        HistorySample &sFront = historySamples[0];
+
+        encodeHistorySample(1, sPrevFront, inputCs, hiddenTargetCsPrev);
+
+        // Hand the full buffers over to the new front
+        std::swap(sFront.inputCs, sPrevFront.inputCs);
+        std::swap(sFront.hiddenTargetCsPrev, sPrevFront.hiddenTargetCsPrev);
+        std::swap(sFront.hiddenValuesPrev, sPrevFront.hiddenValuesPrev);
+    }
     
     // Add new sample
     {
@@ -274,27 +507,78 @@ void Actor::step(
             int numVisibleColumns = vld.size.x * vld.size.y;
 
             // Copy visible Cs
-            runKernel1(cs, std::bind(copyInt, std::placeholders::_1, std::placeholders::_2, inputCs[vli], &s.inputCs[vli]), numVisibleColumns, cs.rng, cs.batchSize1);
+            runKernel1(cs, std::bind(copyInt, std::placeholders::_1, std::placeholders::_2, inputCs[vli], &s.inputCs[vli]), numVisibleColumns, cs.rng, copyShape(numVisibleColumns));
         }
 
         // Copy hidden Cs
-        runKernel1(cs, std::bind(copyInt, std::placeholders::_1, std::placeholders::_2, hiddenTargetCsPrev, &s.hiddenTargetCsPrev), numHiddenColumns, cs.rng, cs.batchSize1);
+        runKernel1(cs, std::bind(copyInt, std::placeholders::_1, std::placeholders::_2, hiddenTargetCsPrev, &s.hiddenTargetCsPrev), numHiddenColumns, cs.rng, copyShape(numHiddenColumns));
 
         // Copy hidden values
-        runKernel1(cs, std::bind(copyFloat, std::placeholders::_1, std::placeholders::_2, &hiddenValues, &s.hiddenValuesPrev), numHiddenColumns, cs.rng, cs.batchSize1);
+        runKernel1(cs, std::bind(copyFloat, std::placeholders::_1, std::placeholders::_2, &hiddenValues, &s.hiddenValuesPrev), numHiddenColumns, cs.rng, copyShape(numHiddenColumns));
 
         s.reward = reward;
     }
 
+    // Eligibility depends on minSteps, which may have changed since the tree was built
+    if (treeMinSteps != minSteps)
+        rebuildPriorityTree();
+
+    // Shift priority tree eligibility along with the history
+    {
+        int frontSlot = historySamples.start;
+
+        historyPriorities[frontSlot] = maxPriority;
+
+        priorityTree.set(frontSlot, 0.0f);
+
+        if (minSteps < historySize - 1) {
+            int slot = (historySamples.start + minSteps) % historySamples.size();
+
+            priorityTree.set(slot, historyPriorities[slot]);
+        }
+
+        // Oldest sample has no predecessor
+        if (historySize > 1)
+            priorityTree.set((historySamples.start + historySize - 1) % historySamples.size(), 0.0f);
+    }
+
+    if (learnEnabled)
+        learn(cs, mimic, historyIters);
+}
+
+void Actor::learn(
+    ComputeSystem &cs,
+    bool mimic,
+    int iters
+) {
+    int numHiddenColumns = hiddenSize.x * hiddenSize.y;
+
+    if (treeMinSteps != minSteps)
+        rebuildPriorityTree();
+
     // Learn (if have sufficient samples)
-    if (learnEnabled && historySize > minSteps + 1) {
+    if (historySize > minSteps + 1) {
         std::uniform_int_distribution<int> historyDist(minSteps, historySize - 2);
 
-        for (int it = 0; it < historyIters; it++) {
-            int historyIndex = historyDist(cs.rng);
+        for (int it = 0; it < iters; it++) {
+            int historyIndex;
+            float importance = 1.0f;
+
+            if (prioritized && priorityTree.total() > 0.0f) {
+                std::uniform_real_distribution<float> cuspDist(0.0f, priorityTree.total());
+
+                int slot = priorityTree.find(cuspDist(cs.rng));
+
+                historyIndex = (slot - historySamples.start + historySamples.size()) % historySamples.size();
+
+                // Importance sampling weight (N P(i))^-exponent normalized by the largest weight (that of the least likely sample)
+                importance = std::pow(priorityTree.minimum() / priorityTree.get(slot), importanceExponent);
+            }
+            else
+                historyIndex = historyDist(cs.rng);
 
-            const HistorySample &sPrev = historySamples[historyIndex + 1];
-            const HistorySample &s = historySamples[historyIndex];
+            const HistorySample &sPrev = getHistorySample(historyIndex + 1, decodedSamplePrev);
+            const HistorySample &s = getHistorySample(historyIndex, decodedSample);
 
             // Compute (partial) values, rest is completed in the kernel
             float q = 0.0f;
@@ -307,7 +591,27 @@ void Actor::step(
             }
 
             // Learn kernel
-            runKernel2(cs, std::bind(Actor::learnKernel, std::placeholders::_1, std::placeholders::_2, this, constGet(sPrev.inputCs), &s.hiddenTargetCsPrev, &sPrev.hiddenValuesPrev, q, g, mimic), Int2(hiddenSize.x, hiddenSize.y), cs.rng, cs.batchSize2);
+            runKernel2(cs, std::bind(Actor::learnKernel, std::placeholders::_1, std::placeholders::_2, this, constGet(sPrev.inputCs), &s.hiddenTargetCsPrev, &sPrev.hiddenValuesPrev, q, g, importance, mimic), Int2(hiddenSize.x, hiddenSize.y), cs.rng, getHiddenShape(kernelALearn), getHiddenPartition(cs, *this, hiddenPartition));
+
+            if (prioritized) {
+                // New priority from mean absolute TD error over columns
+                float tdError = 0.0f;
+
+                for (int i = 0; i < numHiddenColumns; i++)
+                    tdError += hiddenTDErrors[i];
+
+                tdError /= numHiddenColumns;
+
+                float priority = std::pow(tdError + 0.0001f, priorityExponent);
+
+                int slot = (historySamples.start + historyIndex) % historySamples.size();
+
+                historyPriorities[slot] = priority;
+
+                priorityTree.set(slot, priority);
+
+                maxPriority = std::max(maxPriority, priority);
+            }
         }
     }
 }
@@ -315,6 +619,10 @@ void Actor::step(
 void Actor::writeToStream(
     std::ostream &os
 ) const {
+    int versionTag = -actorStreamVersion;
+
+    os.write(reinterpret_cast<const char*>(&versionTag), sizeof(int));
+
     os.write(reinterpret_cast<const char*>(&hiddenSize), sizeof(Int3));
 
     os.write(reinterpret_cast<const char*>(&alpha), sizeof(float));
@@ -322,6 +630,9 @@ void Actor::writeToStream(
     os.write(reinterpret_cast<const char*>(&gamma), sizeof(float));
     os.write(reinterpret_cast<const char*>(&minSteps), sizeof(int));
     os.write(reinterpret_cast<const char*>(&historyIters), sizeof(int));
+    os.write(reinterpret_cast<const char*>(&prioritized), sizeof(bool));
+    os.write(reinterpret_cast<const char*>(&priorityExponent), sizeof(float));
+    os.write(reinterpret_cast<const char*>(&importanceExponent), sizeof(float));
 
     writeBufferToStream(os, &hiddenCs);
 
@@ -354,8 +665,16 @@ void Actor::writeToStream(
 
     os.write(reinterpret_cast<const char*>(&historyStart), sizeof(int));
 
+    char compressed = compressHistory;
+
+    os.write(reinterpret_cast<const char*>(&compressed), sizeof(char));
+    os.write(reinterpret_cast<const char*>(&historyKeyInterval), sizeof(int));
+
+    // Always written decoded
+    HistorySample decoded;
+
     for (int t = 0; t < historySamples.size(); t++) {
-        const HistorySample &s = historySamples[t];
+        const HistorySample &s = getHistorySample(t, decoded);
 
         for (int vli = 0; vli < visibleLayers.size(); vli++)
             writeBufferToStream(os, &s.inputCs[vli]);
@@ -366,12 +685,37 @@ void Actor::writeToStream(
 
         os.write(reinterpret_cast<const char*>(&s.reward), sizeof(float));
     }
+
+    os.write(reinterpret_cast<const char*>(&maxPriority), sizeof(float));
+
+    writeBufferToStream(os, &historyPriorities);
 }
 
 void Actor::readFromStream(
-    std::istream &is
+    std::istream &is,
+    TopologyCache* topologyCache
 ) {
-    is.read(reinterpret_cast<char*>(&hiddenSize), sizeof(Int3));
+    hiddenPartition = KernelPartition();
+
+    int versionTag;
+
+    is.read(reinterpret_cast<char*>(&versionTag), sizeof(int));
+
+    int version = 0;
+
+    if (versionTag < 0) {
+        version = -versionTag;
+
+        is.read(reinterpret_cast<char*>(&hiddenSize), sizeof(Int3));
+    }
+    else {
+        // Unversioned stream, the tag was hiddenSize.x
+        hiddenSize.x = versionTag;
+
+        is.read(reinterpret_cast<char*>(&hiddenSize.y), sizeof(Int3) - sizeof(int));
+    }
+
+    assert(version == 0 || version == actorStreamVersion);
 
     int numHiddenColumns = hiddenSize.x * hiddenSize.y;
     int numHidden = numHiddenColumns * hiddenSize.z;
@@ -382,6 +726,14 @@ void Actor::readFromStream(
     is.read(reinterpret_cast<char*>(&minSteps), sizeof(int));
     is.read(reinterpret_cast<char*>(&historyIters), sizeof(int));
 
+    if (version > 0) {
+        is.read(reinterpret_cast<char*>(&prioritized), sizeof(bool));
+        is.read(reinterpret_cast<char*>(&priorityExponent), sizeof(float));
+        is.read(reinterpret_cast<char*>(&importanceExponent), sizeof(float));
+    }
+    else
+        prioritized = false;
+
     hiddenActivations = FloatBuffer(numHidden, 0.0f);
     
     readBufferFromStream(is, &hiddenCs);
@@ -404,8 +756,8 @@ void Actor::readFromStream(
         int numVisibleColumns = vld.size.x * vld.size.y;
         int numVisible = numVisibleColumns * vld.size.z;
 
-        readSMFromStream(is, vl.valueWeights);
-        readSMFromStream(is, vl.actionWeights);
+        readLocalRFSMFromStream(is, vld.size, Int3(hiddenSize.x, hiddenSize.y, 1), vld.radius, topologyCache, vl.valueWeights);
+        readLocalRFSMFromStream(is, vld.size, hiddenSize, vld.radius, topologyCache, vl.actionWeights);
     }
 
     is.read(reinterpret_cast<char*>(&historySize), sizeof(int));
@@ -418,21 +770,370 @@ void Actor::readFromStream(
 
     is.read(reinterpret_cast<char*>(&historyStart), sizeof(int));
 
+    char compressed = 0;
+
+    if (version > 0) {
+        is.read(reinterpret_cast<char*>(&compressed), sizeof(char));
+        is.read(reinterpret_cast<char*>(&historyKeyInterval), sizeof(int));
+    }
+
+    compressHistory = compressed;
+
     historySamples.resize(numHistorySamples);
     historySamples.start = historyStart;
 
+    if (compressHistory) {
+        compressedSamples.resize(numHistorySamples);
+        compressedSamples.start = historyStart;
+    }
+    else
+        compressedSamples = CircleBuffer<CompressedHistorySample>();
+
+    // Newer neighbor of the sample being read, for delta encoding
+    HistorySample next;
+    HistorySample current;
+
     for (int t = 0; t < historySamples.size(); t++) {
-        HistorySample &s = historySamples[t];
+        current.inputCs.resize(visibleLayers.size());
+
+        for (int vli = 0; vli < visibleLayers.size(); vli++)
+            readBufferFromStream(is, &current.inputCs[vli]);
+
+        readBufferFromStream(is, &current.hiddenTargetCsPrev);
+
+        readBufferFromStream(is, &current.hiddenValuesPrev);
+
+        is.read(reinterpret_cast<char*>(&current.reward), sizeof(float));
+
+        loadHistorySample(t, current, next);
+    }
+
+    if (version > 0) {
+        is.read(reinterpret_cast<char*>(&maxPriority), sizeof(float));
+
+        readBufferFromStream(is, &historyPriorities);
+    }
+    else {
+        maxPriority = 1.0f;
+        historyPriorities = FloatBuffer(numHistorySamples, maxPriority);
+    }
+
+    hiddenTDErrors = FloatBuffer(numHiddenColumns, 0.0f);
+
+    historyPushes = std::numeric_limits<int>::max();
+
+    rebuildPriorityTree();
+}
+
+void Actor::writeToSection(
+    SectionWriter &sw
+) const {
+    sw.writeInt3(hiddenSize);
+
+    sw.write(alpha);
+    sw.write(beta);
+    sw.write(gamma);
+    sw.write(minSteps);
+    sw.write(historyIters);
+    sw.write(static_cast<char>(prioritized));
+    sw.write(priorityExponent);
+    sw.write(importanceExponent);
+
+    sw.writeBuffer(hiddenCs);
+
+    sw.writeBuffer(hiddenValues);
+
+    sw.write(static_cast<int>(visibleLayers.size()));
+
+    for (int vli = 0; vli < visibleLayers.size(); vli++) {
+        const VisibleLayer &vl = visibleLayers[vli];
+        const VisibleLayerDesc &vld = visibleLayerDescs[vli];
+
+        sw.writeInt3(vld.size);
+        sw.write(vld.radius);
+
+        writeLocalRFSMToSection(sw, vl.valueWeights);
+        writeLocalRFSMToSection(sw, vl.actionWeights);
+    }
+
+    sw.write(historySize);
+    sw.write(static_cast<int>(historySamples.size()));
+    sw.write(historySamples.start);
+
+    sw.write(static_cast<char>(compressHistory));
+    sw.write(historyKeyInterval);
+
+    // Deltas only hold the samples pushed since the base (newest first)
+    int numWritten = historySamples.size();
+
+    if (sw.delta) {
+        numWritten = std::min(historyPushes, historySamples.size());
+
+        sw.write(numWritten);
+    }
+
+    // Always written decoded
+    HistorySample decoded;
+
+    for (int t = 0; t < numWritten; t++) {
+        const HistorySample &s = getHistorySample(t, decoded);
+
+        for (int vli = 0; vli < visibleLayers.size(); vli++)
+            sw.writeBuffer(s.inputCs[vli]);
+
+        sw.writeBuffer(s.hiddenTargetCsPrev);
+
+        sw.writeBuffer(s.hiddenValuesPrev);
+
+        sw.write(s.reward);
+    }
+
+    sw.write(maxPriority);
+
+    sw.writeBuffer(historyPriorities);
+}
+
+void Actor::readFromSection(
+    SectionReader &sr,
+    bool readHistory
+) {
+    hiddenPartition = KernelPartition();
+
+    hiddenSize = sr.readSize();
+
+    int numHiddenColumns = hiddenSize.x * hiddenSize.y;
+    int numHidden = numHiddenColumns * hiddenSize.z;
+
+    alpha = sr.read<float>();
+    beta = sr.read<float>();
+    gamma = sr.read<float>();
+    minSteps = sr.read<int>();
+    historyIters = sr.read<int>();
+    prioritized = sr.read<char>();
+    priorityExponent = sr.read<float>();
+    importanceExponent = sr.read<float>();
+
+    hiddenActivations = FloatBuffer(numHidden, 0.0f);
+
+    sr.readBuffer(hiddenCs);
+
+    sr.readBuffer(hiddenValues);
+
+    // Each visible layer takes at least its size and radius
+    int numVisibleLayers = sr.readCount(4 * sizeof(int));
+
+    if (hiddenCs.size() != numHiddenColumns || hiddenValues.size() != numHiddenColumns)
+        sr.fail();
+
+    if (sr.getFailed())
+        return;
+
+    visibleLayers.resize(numVisibleLayers);
+    visibleLayerDescs.resize(numVisibleLayers);
+
+    for (int vli = 0; vli < visibleLayers.size(); vli++) {
+        VisibleLayer &vl = visibleLayers[vli];
+        VisibleLayerDesc &vld = visibleLayerDescs[vli];
+
+        vld.size = sr.readSize();
+        vld.radius = sr.read<int>();
+
+        if (sr.getFailed())
+            return;
+
+        readLocalRFSMFromSection(sr, vld.size, Int3(hiddenSize.x, hiddenSize.y, 1), vld.radius, vl.valueWeights);
+        readLocalRFSMFromSection(sr, vld.size, hiddenSize, vld.radius, vl.actionWeights);
+    }
+
+    historySize = sr.read<int>();
+
+    // Each sample takes at least its buffer counts and reward (deltas hold fewer samples than that)
+    int numHistorySamples = sr.delta ? sr.read<int>() : sr.readCount((visibleLayers.size() + 3) * sizeof(int));
+    int historyStart = sr.read<int>();
+
+    bool compress = sr.read<char>();
+    historyKeyInterval = sr.read<int>();
+
+    if (historySize < 0 || historySize > numHistorySamples || historyStart < 0 || historyStart >= std::max(1, numHistorySamples))
+        sr.fail();
+
+    if (sr.getFailed())
+        return;
+
+    hiddenTDErrors = FloatBuffer(numHiddenColumns, 0.0f);
+
+    // Minimal history, enough to step but not to learn
+    if (!readHistory) {
+        compressHistory = false;
+
+        initHistory(1);
+
+        return;
+    }
+
+    int numRead = numHistorySamples;
+
+    // Slot of the newest sample before this section (for deltas)
+    int startPrev = historySamples.start;
+
+    if (sr.delta) {
+        numRead = sr.readCount((visibleLayers.size() + 3) * sizeof(int));
+
+        // Must patch a history of the same layout, whose newest sample directly follows the new ones
+        if (sr.getFailed() || numHistorySamples != historySamples.size() || compress != compressHistory || numRead > numHistorySamples ||
+            (numRead < numHistorySamples && (historyStart + numRead) % numHistorySamples != startPrev)) {
+            sr.fail();
+
+            return;
+        }
+    }
+    else {
+        compressHistory = compress;
+
+        historySamples.resize(numHistorySamples);
+
+        if (compressHistory)
+            compressedSamples.resize(numHistorySamples);
+        else
+            compressedSamples = CircleBuffer<CompressedHistorySample>();
+    }
+
+    historySamples.start = historyStart;
 
-        s.inputCs.resize(visibleLayers.size());
+    if (compressHistory)
+        compressedSamples.start = historyStart;
+
+    // Newer neighbor of the sample being read, for delta encoding
+    HistorySample next;
+    HistorySample current;
+
+    for (int t = 0; t < numRead; t++) {
+        current.inputCs.resize(visibleLayers.size());
 
         for (int vli = 0; vli < visibleLayers.size(); vli++)
-            readBufferFromStream(is, &s.inputCs[vli]);
+            sr.readBuffer(current.inputCs[vli]);
+
+        sr.readBuffer(current.hiddenTargetCsPrev);
+
+        sr.readBuffer(current.hiddenValuesPrev);
+
+        current.reward = sr.read<float>();
+
+        if (current.hiddenTargetCsPrev.size() != numHiddenColumns || current.hiddenValuesPrev.size() != numHiddenColumns)
+            sr.fail();
+
+        for (int vli = 0; vli < visibleLayers.size(); vli++) {
+            if (current.inputCs[vli].size() != visibleLayerDescs[vli].size.x * visibleLayerDescs[vli].size.y)
+                sr.fail();
+        }
+
+        if (sr.getFailed())
+            return;
+
+        loadHistorySample(t, current, next);
+    }
+
+    // The previous newest sample was stored in full, encode it against its new newer neighbor
+    if (sr.delta && compressHistory && numRead > 0 && numRead < numHistorySamples) {
+        std::swap(current, historySamples[numRead]);
+
+        loadHistorySample(numRead, current, next);
+    }
 
-        readBufferFromStream(is, &s.hiddenTargetCsPrev);
+    maxPriority = sr.read<float>();
 
-        readBufferFromStream(is, &s.hiddenValuesPrev);
+    sr.readBuffer(historyPriorities);
 
-        is.read(reinterpret_cast<char*>(&s.reward), sizeof(float));
+    if (historyPriorities.size() != numHistorySamples) {
+        sr.fail();
+
+        return;
+    }
+
+    historyPushes = std::numeric_limits<int>::max();
+
+    rebuildPriorityTree();
+}
+
+// Buffers of a history sample
+static long long historySampleMemory(
+    const Actor::HistorySample &s
+) {
+    long long bytes = vectorMemory(s.hiddenTargetCsPrev) + vectorMemory(s.hiddenValuesPrev);
+
+    for (int vli = 0; vli < s.inputCs.size(); vli++)
+        bytes += vectorMemory(s.inputCs[vli]);
+
+    return bytes;
+}
+
+MemoryUsage Actor::memoryUsage() const {
+    MemoryUsage usage;
+
+    for (int vli = 0; vli < visibleLayers.size(); vli++) {
+        usage += visibleLayers[vli].valueWeights.memoryUsage();
+        usage += visibleLayers[vli].actionWeights.memoryUsage();
+    }
+
+    usage.states += vectorMemory(hiddenActivations) + vectorMemory(hiddenCs) + vectorMemory(hiddenValues) + vectorMemory(hiddenTDErrors);
+
+    for (int i = 0; i < historySamples.data.size(); i++)
+        usage.replay += historySampleMemory(historySamples.data[i]);
+
+    for (int i = 0; i < compressedSamples.data.size(); i++) {
+        const CompressedHistorySample &s = compressedSamples.data[i];
+
+        usage.replay += vectorMemory(s.hiddenTargetCsPrev) + vectorMemory(s.hiddenValuesPrev);
+
+        for (int vli = 0; vli < s.inputCs.size(); vli++)
+            usage.replay += vectorMemory(s.inputCs[vli]);
+    }
+
+    usage.replay += historySampleMemory(decodedSample) + historySampleMemory(decodedSamplePrev);
+
+    usage.replay += vectorMemory(historyPriorities) + vectorMemory(priorityTree.nodes) + vectorMemory(priorityTree.minNodes);
+
+    usage.other += vectorMemory(hiddenPartition.starts);
+
+    return usage;
+}
+
+MemoryUsage Actor::estimateMemoryUsage(
+    const Int3 &hiddenSize,
+    int historyCapacity,
+    const std::vector<VisibleLayerDesc> &visibleLayerDescs,
+    bool compressHistory
+) {
+    MemoryUsage usage;
+
+    long long numHiddenColumns = static_cast<long long>(hiddenSize.x) * hiddenSize.y;
+
+    // Size of a full history sample
+    long long sampleBytes = numHiddenColumns * (sizeof(int) + sizeof(float));
+
+    for (int vli = 0; vli < visibleLayerDescs.size(); vli++) {
+        const VisibleLayerDesc &vld = visibleLayerDescs[vli];
+
+        usage += estimateSMLocalRF(vld.size, Int3(hiddenSize.x, hiddenSize.y, 1), vld.radius, false);
+        usage += estimateSMLocalRF(vld.size, hiddenSize, vld.radius, false);
+
+        sampleBytes += static_cast<long long>(vld.size.x) * vld.size.y * sizeof(int);
     }
-}
\ No newline at end of file
+
+    usage.states += numHiddenColumns * hiddenSize.z * sizeof(float) + numHiddenColumns * (sizeof(int) + sizeof(float) * 2);
+
+    // Compression keeps one full sample plus half precision values, deltas start empty
+    if (compressHistory)
+        usage.replay += sampleBytes + historyCapacity * numHiddenColumns * sizeof(unsigned short);
+    else
+        usage.replay += historyCapacity * sampleBytes;
+
+    int numLeaves = 1;
+
+    while (numLeaves < historyCapacity)
+        numLeaves *= 2;
+
+    usage.replay += historyCapacity * sizeof(float) + numLeaves * 4 * sizeof(float);
+
+    return usage;
+}
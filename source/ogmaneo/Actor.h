@@ -9,6 +9,9 @@
 #pragma once
 
 #include "ComputeSystem.h"
+#include "ModelFile.h"
+
+#include <limits>
 
 namespace ogmaneo {
 // A reinforcement learning layer
@@ -44,6 +47,17 @@ public:
         float reward;
     };
 
+    // Encoded payload of a history sample when history compression is enabled
+    struct CompressedHistorySample {
+        // Full copies if key, otherwise (index, value) pairs of columns that differ from the next newer sample
+        std::vector<IntBuffer> inputCs;
+        IntBuffer hiddenTargetCsPrev;
+
+        std::vector<unsigned short> hiddenValuesPrev; // Half precision
+
+        bool key; // Whether this sample can be decoded without newer samples
+    };
+
 private:
     Int3 hiddenSize; // Hidden/output/action size
 
@@ -58,17 +72,46 @@ private:
 
     CircleBuffer<HistorySample> historySamples; // History buffer, fixed length
 
+    // When compressing, only the newest sample in historySamples holds data, the rest is encoded here (same start)
+    bool compressHistory;
+    CircleBuffer<CompressedHistorySample> compressedSamples;
+
+    // Decoded replay samples (scratch)
+    HistorySample decodedSample;
+    HistorySample decodedSamplePrev;
+
+    FloatBuffer hiddenTDErrors; // Per-column absolute TD errors of the last learn kernel
+
+    // Prioritized replay
+    FloatBuffer historyPriorities; // Priority per history buffer slot (indexed like historySamples.data)
+    SumTree priorityTree; // Sampling tree over slots, zero for slots that are not eligible for replay
+    float maxPriority; // Priority given to new samples
+    int treeMinSteps; // minSteps the eligibility in priorityTree was computed for
+
+    int historyPushes; // Samples pushed since resetHistoryPushes (saturates), delta sections only hold these
+
     // Visible layers and descriptors
     std::vector<VisibleLayer> visibleLayers;
     std::vector<VisibleLayerDesc> visibleLayerDescs;
 
+    // Cost-balanced split of hidden columns, used if ComputeSystem::costBalanced
+    KernelPartition hiddenPartition;
+
+    // Shape of a kernel over the hidden columns, for batch size lookup
+    KernelShape getHiddenShape(
+        KernelClass kernelClass
+    ) const;
+
     // --- Kernels ---
 
     void forward(
         const Int2 &pos,
         std::mt19937 &rng,
-        const std::vector<const IntBuffer*> &inputCs
-    );
+        const std::vector<const IntBuffer*> &inputCs,
+        IntBuffer* hiddenCsOut,
+        FloatBuffer* hiddenValuesOut,
+        FloatBuffer* hiddenActivationsOut
+    ) const;
 
     void learn(
         const Int2 &pos,
@@ -78,16 +121,62 @@ private:
         const FloatBuffer* hiddenValuesPrev,
         float q,
         float g,
+        float importance,
         bool mimic
     );
 
+    // Allocate an empty history (and priorities) of the given capacity
+    void initHistory(
+        int historyCapacity
+    );
+
+    // Refresh eligibility of all slots in the priority tree
+    void rebuildPriorityTree();
+
+    // Encode the history sample at index t (> 0) against the next newer sample
+    void encodeHistorySample(
+        int t,
+        const HistorySample &s,
+        const std::vector<const IntBuffer*> &inputCsNext,
+        const IntBuffer* hiddenTargetCsPrevNext
+    );
+
+    // Reconstruct the full history sample at index t
+    void decodeHistorySample(
+        int t,
+        HistorySample &s
+    ) const;
+
+    // Get the full history sample at index t, decoding into scratch if compressed
+    const HistorySample &getHistorySample(
+        int t,
+        HistorySample &scratch
+    ) const {
+        if (!compressHistory)
+            return historySamples[t];
+
+        decodeHistorySample(t, scratch);
+
+        return scratch;
+    }
+
+    // Store a history sample that was read at index t, samples must be loaded in order of increasing t. Swaps out s
+    void loadHistorySample(
+        int t,
+        HistorySample &s,
+        HistorySample &next
+    );
+
     static void forwardKernel(
         const Int2 &pos,
         std::mt19937 &rng,
-        Actor* a,
-        const std::vector<const IntBuffer*> &inputCs
+        const Actor* a,
+        const std::vector<const IntBuffer*> &inputCs,
+        IntBuffer* hiddenCsOut,
+        FloatBuffer* hiddenValuesOut,
+        FloatBuffer* hiddenActivationsOut
     ) {
-        a->forward(pos, rng, inputCs);
+        a->forward(pos, rng, inputCs, hiddenCsOut, hiddenValuesOut, hiddenActivationsOut);
     }
 
     static void learnKernel(
@@ -99,9 +188,10 @@ private:
         const FloatBuffer* hiddenValuesPrev,
         float q,
         float g,
+        float importance,
         bool mimic
     ) {
-        a->learn(pos, rng, inputCsPrev, hiddenTargetCsPrev, hiddenValuesPrev, q, g, mimic);
+        a->learn(pos, rng, inputCsPrev, hiddenTargetCsPrev, hiddenValuesPrev, q, g, importance, mimic);
     }
 
 public:
@@ -110,15 +200,27 @@ public:
     float gamma; // Discount factor
     int minSteps; // Minimum steps back in time
     int historyIters; // Number of iterations to update
+    int historyKeyInterval; // Store every n-th history slot in full when compressing, bounds decoding cost
+    bool prioritized; // Sample history proportionally to TD error instead of uniformly
+    float priorityExponent; // How strongly TD error skews sampling (0 = uniform)
+    float importanceExponent; // Strength of the importance sampling correction (0 = none, 1 = full), weights are normalized by their maximum
 
     // Defaults
     Actor()
     :
+    compressHistory(false),
+    maxPriority(1.0f),
+    treeMinSteps(-1),
+    historyPushes(std::numeric_limits<int>::max()),
     alpha(0.02f),
     beta(0.02f),
     gamma(0.99f),
     minSteps(8),
-    historyIters(8)
+    historyIters(8),
+    historyKeyInterval(8),
+    prioritized(false),
+    priorityExponent(0.6f),
+    importanceExponent(0.4f)
     {}
 
     // Initialized randomly
@@ -126,9 +228,25 @@ public:
         ComputeSystem &cs,
         const Int3 &hiddenSize,
         int historyCapacity,
-        const std::vector<VisibleLayerDesc> &visibleLayerDescs
+        const std::vector<VisibleLayerDesc> &visibleLayerDescs,
+        bool compressHistory = false // Delta encode history samples to save memory (decoded on replay)
+    );
+
+    // Compute actions and values only, without recording history or learning
+    void activate(
+        ComputeSystem &cs,
+        const std::vector<const IntBuffer*> &inputCs
     );
 
+    // Compute actions and values into external state, only reads the layer so several may run at once (e.g. rollouts)
+    void activate(
+        ComputeSystem &cs,
+        const std::vector<const IntBuffer*> &inputCs,
+        IntBuffer* hiddenCsOut, // Actions to write, same size as getHiddenCs
+        FloatBuffer* hiddenValuesOut, // Values to write, same size as getHiddenValues
+        FloatBuffer* hiddenActivationsOut // Activations to write (scratch), one per hidden cell
+    ) const;
+
     // Step (get actions and update)
     void step(
         ComputeSystem &cs,
@@ -139,6 +257,13 @@ public:
         bool mimic
     );
 
+    // Replay learning from the history, as done at the end of step (with historyIters iterations)
+    void learn(
+        ComputeSystem &cs,
+        bool mimic,
+        int iters // Number of replay iterations
+    );
+
     // Write to stream
     void writeToStream(
         std::ostream &os // Stream to write to
@@ -146,9 +271,31 @@ public:
 
     // Read from stream
     void readFromStream(
-        std::istream &is // Stream to read from
+        std::istream &is, // Stream to read from
+        TopologyCache* topologyCache = nullptr // Optional cache to take weight topologies from instead of the stream
     );
 
+    // Write to a model file section
+    void writeToSection(
+        SectionWriter &sw // Section to write to
+    ) const;
+
+    // Read from a model file section
+    void readFromSection(
+        SectionReader &sr, // Section to read from
+        bool readHistory = true // If false, the replay history is skipped and the actor can step but not learn
+    );
+
+    // Count pushed history samples from now on, delta sections then only hold samples added after this
+    void resetHistoryPushes() {
+        historyPushes = 0;
+    }
+
+    // Treat the whole history as changed (delta sections hold all of it)
+    void markHistoryChanged() {
+        historyPushes = std::numeric_limits<int>::max();
+    }
+
     // Get number of visible layers
     int getNumVisibleLayers() const {
         return visibleLayers.size();
@@ -168,11 +315,37 @@ public:
         return visibleLayerDescs[i];
     }
 
+    // Append all weight matrices (e.g. for dirty tracking)
+    void getWeightMatrices(
+        std::vector<SparseMatrix*> &mats
+    ) {
+        for (int vli = 0; vli < visibleLayers.size(); vli++) {
+            mats.push_back(&visibleLayers[vli].valueWeights);
+            mats.push_back(&visibleLayers[vli].actionWeights);
+        }
+    }
+
+    // Memory held by weights, states, history (replay buffer) and kernel partitions
+    MemoryUsage memoryUsage() const;
+
+    // Memory initRandom will allocate for these arguments. Compressed histories grow past this as deltas are stored
+    static MemoryUsage estimateMemoryUsage(
+        const Int3 &hiddenSize, // Hidden/output/action size
+        int historyCapacity, // Maximum number of history samples
+        const std::vector<VisibleLayerDesc> &visibleLayerDescs, // Descriptors for visible layers
+        bool compressHistory = false // Whether history is delta encoded
+    );
+
     // Get hidden state/output/actions
     const IntBuffer &getHiddenCs() const {
         return hiddenCs;
     }
 
+    // Get hidden values (value estimate per column)
+    const FloatBuffer &getHiddenValues() const {
+        return hiddenValues;
+    }
+
     // Get the hidden size
     const Int3 &getHiddenSize() const {
         return hiddenSize;
@@ -0,0 +1,87 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#include "AsyncLearner.h"
+
+using namespace ogmaneo;
+
+AsyncLearner::~AsyncLearner() {
+    if (worker.joinable()) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            quit = true;
+        }
+
+        cond.notify_all();
+
+        worker.join();
+    }
+}
+
+void AsyncLearner::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+        cond.wait(lock, [this] { return pending || quit; });
+
+        // Finish queued work before quitting
+        if (pending) {
+            lock.unlock();
+
+            h->learnDeferred(*cs);
+
+            lock.lock();
+
+            pending = false;
+
+            cond.notify_all();
+        }
+        else if (quit)
+            break;
+    }
+}
+
+void AsyncLearner::step(
+    ComputeSystem &cs,
+    Hierarchy &h,
+    const std::vector<const IntBuffer*> &inputCs,
+    float reward,
+    bool mimic
+) {
+    wait();
+
+    // Started lazily, so unused learners cost no thread
+    if (!worker.joinable())
+        worker = std::thread(&AsyncLearner::run, this);
+
+    h.stepDeferred(cs, inputCs, reward, mimic);
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        this->h = &h;
+        this->cs = &cs;
+
+        pending = true;
+    }
+
+    cond.notify_all();
+}
+
+void AsyncLearner::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    cond.wait(lock, [this] { return !pending; });
+}
+
+bool AsyncLearner::isLearning() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    return pending;
+}
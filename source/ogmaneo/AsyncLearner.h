@@ -0,0 +1,67 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#pragma once
+
+#include "Hierarchy.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace ogmaneo {
+// Steps a hierarchy with learning moved to a persistent background thread.
+// step returns once inference is done; the learning of that step runs while the caller does other work,
+// and the next step waits for it first. See Hierarchy::stepDeferred for the consistency model
+class AsyncLearner {
+private:
+    Hierarchy* h;
+    ComputeSystem* cs;
+
+    std::thread worker;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    bool pending; // Learning queued or running
+    bool quit;
+
+    void run();
+
+public:
+    AsyncLearner()
+    :
+    h(nullptr),
+    cs(nullptr),
+    pending(false),
+    quit(false)
+    {}
+
+    ~AsyncLearner();
+
+    // Non-copyable (owns a thread)
+    AsyncLearner(const AsyncLearner &other) = delete;
+    AsyncLearner &operator=(const AsyncLearner &other) = delete;
+
+    // Wait for the previous step's learning, run inference and queue learning.
+    // h and cs must not be used elsewhere until wait (except reading predictions)
+    void step(
+        ComputeSystem &cs, // Compute system, used by the worker while learning
+        Hierarchy &h, // Hierarchy to step
+        const std::vector<const IntBuffer*> &inputCs, // Inputs to remember
+        float reward = 0.0f, // Optional reward for actor layers
+        bool mimic = false // Use to train action inputs to act as predictors (mimic learning)
+    );
+
+    // Block until queued learning is done
+    void wait();
+
+    // Whether learning is queued or running
+    bool isLearning();
+};
+} // namespace ogmaneo
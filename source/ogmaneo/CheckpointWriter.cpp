@@ -0,0 +1,56 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#include "CheckpointWriter.h"
+
+#include <cstdio>
+
+using namespace ogmaneo;
+
+void CheckpointWriter::write(
+    std::string fileName,
+    bool compact
+) {
+    std::string tempFileName = fileName + ".tmp";
+
+    succeeded = snapshot.writeToFile(tempFileName, compact) && std::rename(tempFileName.c_str(), fileName.c_str()) == 0;
+
+    if (!succeeded)
+        std::remove(tempFileName.c_str());
+
+    busy = false;
+}
+
+bool CheckpointWriter::start(
+    const Hierarchy &h,
+    const std::string &fileName,
+    bool compact
+) {
+    if (busy)
+        return false;
+
+    // Previous worker has finished, release it
+    if (worker.joinable())
+        worker.join();
+
+    // Deep copy, O(model size) on the calling thread
+    snapshot = h;
+
+    busy = true;
+
+    worker = std::thread(&CheckpointWriter::write, this, fileName, compact);
+
+    return true;
+}
+
+bool CheckpointWriter::wait() {
+    if (worker.joinable())
+        worker.join();
+
+    return succeeded;
+}
@@ -0,0 +1,68 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#pragma once
+
+#include "Hierarchy.h"
+
+#include <thread>
+#include <atomic>
+
+namespace ogmaneo {
+// Writes hierarchy checkpoints on a background thread.
+// The hierarchy is snapshotted on the calling thread (a plain copy, no encoding), after which stepping may continue
+// while the snapshot is serialized. Snapshot storage is reused between checkpoints.
+// By design the snapshot is a full deep copy: start blocks for O(model size), but this is a memory bandwidth bound copy
+// (no allocation after the first checkpoint) and roughly an order of magnitude cheaper than encoding the model.
+// Copy-on-write is deliberately not used, as it would put a per-block check in every learning kernel.
+class CheckpointWriter {
+private:
+    Hierarchy snapshot;
+
+    std::thread worker;
+
+    std::atomic<bool> busy;
+    bool succeeded; // Result of the last finished write
+
+    void write(
+        std::string fileName,
+        bool compact
+    );
+
+public:
+    CheckpointWriter()
+    :
+    busy(false),
+    succeeded(true)
+    {}
+
+    ~CheckpointWriter() {
+        wait();
+    }
+
+    // Non-copyable (owns a thread)
+    CheckpointWriter(const CheckpointWriter &other) = delete;
+    CheckpointWriter &operator=(const CheckpointWriter &other) = delete;
+
+    // Snapshot h (blocking, copies the whole model) and write it to a model file in the background. The file is written
+    // under a temporary name and renamed once complete. Returns false (and does nothing) if the previous write is still in progress
+    bool start(
+        const Hierarchy &h, // Hierarchy to snapshot
+        const std::string &fileName, // Name of file to write
+        bool compact = false // Omit topology (see Hierarchy::writeToModel)
+    );
+
+    // Whether a write is in progress
+    bool isBusy() const {
+        return busy;
+    }
+
+    // Block until the current write (if any) is done, returns whether the last write succeeded
+    bool wait();
+};
+} // namespace ogmaneo
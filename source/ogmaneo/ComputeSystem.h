@@ -8,12 +8,23 @@
 
 #pragma once
 
-#include "Helpers.h"
+#include "TopologyCache.h"
+#include "KernelTuner.h"
+#include "Profiler.h"
+#include "TraceRecorder.h"
+#include "LatencyHistogram.h"
 #include <omp.h>
 
 #include <random>
 
 namespace ogmaneo {
+// How kernel batches are distributed over threads
+enum KernelSchedule {
+	scheduleStatic = 0,
+	scheduleDynamic = 1,
+	scheduleGuided = 2
+};
+
 class ComputeSystem {
 public:
 	// Default batch sizes for dimensions 1-3
@@ -24,13 +35,74 @@ public:
 	// Default RNG
 	std::mt19937 rng;
 
+	// Optional topology cache used when creating layers (not owned, may be shared)
+	TopologyCache* topologyCache;
+
+	// Optional tuner choosing batch sizes per kernel class and layer shape (not owned, may be shared)
+	KernelTuner* kernelTuner;
+
+	// Optional profiler recording kernel and layer timings (not owned), null disables profiling
+	Profiler* profiler;
+
+	// Optional recorder of kernel launch, worker thread and layer spans (not owned), null disables tracing
+	TraceRecorder* traceRecorder;
+
+	// Optional step latency histograms filled by Hierarchy (not owned), null disables them
+	StepLatencies* stepLatencies;
+
+	// Distribution of batches over threads
+	KernelSchedule schedule;
+
+	// Split kernels over hidden columns by number of weights instead of into batchSize2 tiles,
+	// evens out layers whose border columns have clamped (smaller) receptive fields
+	bool costBalanced;
+
+	// Estimated work (elements times work per element) a thread must get before it is woken for a kernel.
+	// Tiny kernels run on fewer threads or serially. 0 always uses all threads
+	int minWorkPerThread;
+
 	ComputeSystem()
 	:
 	batchSize1(512),
 	batchSize2(2, 2),
-	batchSize3(2, 2, 2)
+	batchSize3(2, 2, 2),
+	topologyCache(nullptr),
+	kernelTuner(nullptr),
+	profiler(nullptr),
+	traceRecorder(nullptr),
+	stepLatencies(nullptr),
+	schedule(scheduleStatic),
+	costBalanced(false),
+	minWorkPerThread(4096)
 	{}
 
+	// Copy everything but the RNG, e.g. to refresh compute systems that keep their own RNG
+	void copySettings(
+		const ComputeSystem &other
+	) {
+		batchSize1 = other.batchSize1;
+		batchSize2 = other.batchSize2;
+		batchSize3 = other.batchSize3;
+		topologyCache = other.topologyCache;
+		kernelTuner = other.kernelTuner;
+		profiler = other.profiler;
+		traceRecorder = other.traceRecorder;
+		stepLatencies = other.stepLatencies;
+		schedule = other.schedule;
+		costBalanced = other.costBalanced;
+		minWorkPerThread = other.minWorkPerThread;
+	}
+
+	// Profile collected so far, empty without a profiler
+	void getProfile(
+		ProfileReport &report
+	) const {
+		if (profiler != nullptr)
+			profiler->getReport(report);
+		else
+			report = ProfileReport();
+	}
+
 	static void setNumThreads(int numThreads) {
 		omp_set_num_threads(numThreads);
 	}
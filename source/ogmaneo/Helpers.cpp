@@ -10,38 +10,236 @@
 
 #include "ComputeSystem.h"
 
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
 using namespace ogmaneo;
 
-void ogmaneo::runKernel1(
+void SumTree::resize(
+    int size
+) {
+    numLeaves = 1;
+
+    while (numLeaves < size)
+        numLeaves *= 2;
+
+    nodes = std::vector<float>(numLeaves * 2, 0.0f);
+    minNodes = std::vector<float>(numLeaves * 2, std::numeric_limits<float>::infinity());
+}
+
+void SumTree::set(
+    int index,
+    float value
+) {
+    int node = numLeaves + index;
+
+    nodes[node] = value;
+    minNodes[node] = value > 0.0f ? value : std::numeric_limits<float>::infinity();
+
+    // Recompute ancestors from children, avoids accumulating float error
+    for (node /= 2; node >= 1; node /= 2) {
+        nodes[node] = nodes[node * 2] + nodes[node * 2 + 1];
+        minNodes[node] = std::min(minNodes[node * 2], minNodes[node * 2 + 1]);
+    }
+}
+
+int SumTree::find(
+    float value
+) const {
+    int node = 1;
+
+    while (node < numLeaves) {
+        int left = node * 2;
+
+        if (value < nodes[left] || nodes[left + 1] <= 0.0f)
+            node = left;
+        else {
+            value -= nodes[left];
+
+            node = left + 1;
+        }
+    }
+
+    return node - numLeaves;
+}
+
+// Schedule for the next schedule(runtime) loop on this thread
+static void setKernelSchedule(
+    const ComputeSystem &cs
+) {
+    switch (cs.schedule) {
+    case scheduleDynamic:
+        omp_set_schedule(omp_sched_dynamic, 1);
+
+        break;
+    case scheduleGuided:
+        omp_set_schedule(omp_sched_guided, 1);
+
+        break;
+    default:
+        omp_set_schedule(omp_sched_static, 0);
+
+        break;
+    }
+}
+
+// Threads worth waking for a launch: all of them for large kernels, fewer (down to serial) for tiny ones
+static int launchThreads(
+    const ComputeSystem &cs,
+    long long work,
+    int batches
+) {
+    long long numThreads = std::min(omp_get_max_threads(), batches);
+
+    if (cs.minWorkPerThread > 0)
+        numThreads = std::min(numThreads, work / cs.minWorkPerThread);
+
+    return std::max(1ll, numThreads);
+}
+
+void ogmaneo::addColumnCosts(
+    const SparseMatrix &mat,
+    int numColumns,
+    std::vector<int> &costs
+) {
+    int rowsPerColumn = mat.rows / numColumns;
+
+    for (int i = 0; i < numColumns; i++)
+        costs[i] += mat.rowRanges[(i + 1) * rowsPerColumn] - mat.rowRanges[i * rowsPerColumn];
+}
+
+void ogmaneo::initPartition(
+    const Int2 &size,
+    const std::vector<int> &costs,
+    int numRanges,
+    KernelPartition &partition
+) {
+    int numColumns = size.x * size.y;
+
+    partition.numRanges = numRanges;
+
+    numRanges = std::max(1, std::min(numRanges, numColumns));
+
+    long long total = 0;
+
+    for (int i = 0; i < numColumns; i++)
+        total += costs[i];
+
+    partition.size = size;
+    partition.starts.clear();
+    partition.starts.push_back(0);
+
+    // Close a range once the running cost passes its share of the total
+    long long sum = 0;
+
+    for (int i = 0; i < numColumns && partition.starts.size() < numRanges; i++) {
+        sum += costs[i];
+
+        if (sum * numRanges >= total * partition.starts.size())
+            partition.starts.push_back(i + 1);
+    }
+
+    if (partition.starts.back() != numColumns)
+        partition.starts.push_back(numColumns);
+}
+
+const KernelPartition* ogmaneo::updateHiddenPartition(
+    ComputeSystem &cs,
+    const std::function<void(std::vector<SparseMatrix*> &)> &getMats,
+    const Int3 &hiddenSize,
+    KernelPartition &partition
+) {
+    if (!cs.costBalanced)
+        return nullptr;
+
+    int numThreads = omp_get_max_threads();
+
+    // A few ranges per thread so dynamic schedules can still even out the remainder
+    int numRanges = numThreads * 4;
+
+    Int2 size(hiddenSize.x, hiddenSize.y);
+
+    if (partition.size.x != size.x || partition.size.y != size.y || partition.numRanges != numRanges || partition.numThreads != numThreads) {
+        std::vector<SparseMatrix*> mats;
+
+        getMats(mats);
+
+        std::vector<int> costs(size.x * size.y, 0);
+
+        for (int i = 0; i < mats.size(); i++)
+            addColumnCosts(*mats[i], size.x * size.y, costs);
+
+        initPartition(size, costs, numRanges, partition);
+
+        partition.numThreads = numThreads;
+    }
+
+    return &partition;
+}
+
+// Record the part of a launch a worker thread spent in the kernel, up to its arrival at the closing barrier
+static void traceWorker(
+    ComputeSystem &cs,
+    KernelClass kernelClass,
+    std::chrono::steady_clock::time_point start
+) {
+    cs.traceRecorder->record(kernelClassName(kernelClass), "worker", start, std::chrono::steady_clock::now(), omp_get_thread_num(), 0);
+}
+
+static void executeKernel1(
     ComputeSystem &cs,
     const std::function<void(int, std::mt19937 &)> &func,
     int size,
     std::mt19937 &rng,
-    int batchSize
+    int batchSize,
+    int workPerElement,
+    KernelClass kernelClass
 ) {
     std::uniform_int_distribution<int> seedDist(0, 999999);
 
     // Ceil divide
     int batches = (size + batchSize - 1) / batchSize;
 
-    #pragma omp parallel for
-    for (int i = 0; i < batches; i++) {
-        int itemBatchSize = std::min(size - i * batchSize, batchSize);
-        
-        std::mt19937 subRng(seedDist(rng));
+    int numThreads = launchThreads(cs, static_cast<long long>(size) * workPerElement, batches);
+
+    bool tracing = cs.traceRecorder != nullptr;
+
+    setKernelSchedule(cs);
+
+    #pragma omp parallel num_threads(numThreads) if(numThreads > 1)
+    {
+        std::chrono::steady_clock::time_point start;
 
-        int pos = i * batchSize;
+        if (tracing)
+            start = std::chrono::steady_clock::now();
+
+        #pragma omp for schedule(runtime) nowait
+        for (int i = 0; i < batches; i++) {
+            int itemBatchSize = std::min(size - i * batchSize, batchSize);
+            
+            std::mt19937 subRng(seedDist(rng));
+
+            int pos = i * batchSize;
+
+            for (int x = 0; x < itemBatchSize; x++)
+                func(pos + x, subRng);
+        }
 
-        for (int x = 0; x < itemBatchSize; x++)
-            func(pos + x, subRng);
+        if (tracing)
+            traceWorker(cs, kernelClass, start);
     }
 }
 
-void ogmaneo::runKernel2(
+static void executeKernel2(
     ComputeSystem &cs,
     const std::function<void(const Int2 &, std::mt19937 &)> &func,
-    const Int2 &size, std::mt19937 &rng,
-    const Int2 &batchSize
+    const Int2 &size,
+    std::mt19937 &rng,
+    const Int2 &batchSize,
+    int workPerElement,
+    KernelClass kernelClass
 ) {
     std::uniform_int_distribution<int> seedDist(0, 999999);
 
@@ -50,33 +248,93 @@ void ogmaneo::runKernel2(
 
     int totalBatches = batches.x * batches.y;
 
-    #pragma omp parallel for
-    for (int i = 0; i < totalBatches; i++) {
-        int bx = i % batches.x;
-        int by = (i / batches.x) % batches.y;
+    int numThreads = launchThreads(cs, static_cast<long long>(size.x) * size.y * workPerElement, totalBatches);
+
+    bool tracing = cs.traceRecorder != nullptr;
+
+    setKernelSchedule(cs);
 
-        Int2 itemBatchSize = Int2(std::min(size.x - bx * batchSize.x, batchSize.x), std::min(size.y - by * batchSize.y, batchSize.y));
+    #pragma omp parallel num_threads(numThreads) if(numThreads > 1)
+    {
+        std::chrono::steady_clock::time_point start;
 
-        std::mt19937 subRng(seedDist(rng));
-        Int2 pos(bx * batchSize.x, by * batchSize.y);
+        if (tracing)
+            start = std::chrono::steady_clock::now();
 
-        for (int x = 0; x < itemBatchSize.x; x++)
-            for (int y = 0; y < itemBatchSize.y; y++) {
-                Int2 bPos;
-                bPos.x = pos.x + x;
-                bPos.y = pos.y + y;
+        #pragma omp for schedule(runtime) nowait
+        for (int i = 0; i < totalBatches; i++) {
+            int bx = i % batches.x;
+            int by = (i / batches.x) % batches.y;
+
+            Int2 itemBatchSize = Int2(std::min(size.x - bx * batchSize.x, batchSize.x), std::min(size.y - by * batchSize.y, batchSize.y));
+
+            std::mt19937 subRng(seedDist(rng));
+            Int2 pos(bx * batchSize.x, by * batchSize.y);
+
+            for (int x = 0; x < itemBatchSize.x; x++)
+                for (int y = 0; y < itemBatchSize.y; y++) {
+                    Int2 bPos;
+                    bPos.x = pos.x + x;
+                    bPos.y = pos.y + y;
 
-                func(bPos, subRng);
-            }
+                    func(bPos, subRng);
+                }
+        }
+
+        if (tracing)
+            traceWorker(cs, kernelClass, start);
     }
 }
 
-void ogmaneo::runKernel3(
+static void executeKernel2(
+    ComputeSystem &cs,
+    const std::function<void(const Int2 &, std::mt19937 &)> &func,
+    const Int2 &size,
+    std::mt19937 &rng,
+    const KernelPartition* partition,
+    int workPerElement,
+    KernelClass kernelClass
+) {
+    assert(partition->size.x == size.x && partition->size.y == size.y);
+
+    std::uniform_int_distribution<int> seedDist(0, 999999);
+
+    int numRanges = partition->starts.size() - 1;
+
+    int numThreads = launchThreads(cs, static_cast<long long>(size.x) * size.y * workPerElement, numRanges);
+
+    bool tracing = cs.traceRecorder != nullptr;
+
+    setKernelSchedule(cs);
+
+    #pragma omp parallel num_threads(numThreads) if(numThreads > 1)
+    {
+        std::chrono::steady_clock::time_point start;
+
+        if (tracing)
+            start = std::chrono::steady_clock::now();
+
+        #pragma omp for schedule(runtime) nowait
+        for (int r = 0; r < numRanges; r++) {
+            std::mt19937 subRng(seedDist(rng));
+
+            for (int i = partition->starts[r]; i < partition->starts[r + 1]; i++)
+                func(Int2(i / size.y, i % size.y), subRng);
+        }
+
+        if (tracing)
+            traceWorker(cs, kernelClass, start);
+    }
+}
+
+static void executeKernel3(
     ComputeSystem &cs,
     const std::function<void(const Int3 &, std::mt19937 &)> &func,
     const Int3 &size,
     std::mt19937 &rng,
-    const Int3 &batchSize
+    const Int3 &batchSize,
+    int workPerElement,
+    KernelClass kernelClass
 ) {
     std::uniform_int_distribution<int> seedDist(0, 999999);
 
@@ -84,29 +342,231 @@ void ogmaneo::runKernel3(
     Int3 batches((size.x + batchSize.x - 1) / batchSize.x, (size.y + batchSize.y - 1) / batchSize.y, (size.z + batchSize.z - 1) / batchSize.z);
 
     int totalBatches = batches.x * batches.y * batches.z;
-    
-    #pragma omp parallel for
-    for (int i = 0; i < totalBatches; i++) {
-        int bx = i % batches.x;
-        int by = (i / batches.x) % batches.y;
-        int bz = (i / (batches.x * batches.y)) % batches.z;
 
-        Int3 itemBatchSize = Int3(std::min(size.x - bx * batchSize.x, batchSize.x), std::min(size.y - by * batchSize.y, batchSize.y), std::min(size.z - bz * batchSize.z, batchSize.z));
+    int numThreads = launchThreads(cs, static_cast<long long>(size.x) * size.y * size.z * workPerElement, totalBatches);
 
-        std::mt19937 subRng(seedDist(rng));
-        Int3 pos(bx * batchSize.x, by * batchSize.y, bz * batchSize.z);
+    bool tracing = cs.traceRecorder != nullptr;
 
-        for (int x = 0; x < itemBatchSize.x; x++)
-            for (int y = 0; y < itemBatchSize.y; y++)
-                for (int z = 0; z < itemBatchSize.z; z++) {
-                    Int3 bPos;
-                    bPos.x = pos.x + x;
-                    bPos.y = pos.y + y;
-                    bPos.z = pos.z + z;
+    setKernelSchedule(cs);
 
-                    func(bPos, subRng);
-                }
+    #pragma omp parallel num_threads(numThreads) if(numThreads > 1)
+    {
+        std::chrono::steady_clock::time_point start;
+
+        if (tracing)
+            start = std::chrono::steady_clock::now();
+
+        #pragma omp for schedule(runtime) nowait
+        for (int i = 0; i < totalBatches; i++) {
+            int bx = i % batches.x;
+            int by = (i / batches.x) % batches.y;
+            int bz = (i / (batches.x * batches.y)) % batches.z;
+
+            Int3 itemBatchSize = Int3(std::min(size.x - bx * batchSize.x, batchSize.x), std::min(size.y - by * batchSize.y, batchSize.y), std::min(size.z - bz * batchSize.z, batchSize.z));
+
+            std::mt19937 subRng(seedDist(rng));
+            Int3 pos(bx * batchSize.x, by * batchSize.y, bz * batchSize.z);
+
+            for (int x = 0; x < itemBatchSize.x; x++)
+                for (int y = 0; y < itemBatchSize.y; y++)
+                    for (int z = 0; z < itemBatchSize.z; z++) {
+                        Int3 bPos;
+                        bPos.x = pos.x + x;
+                        bPos.y = pos.y + y;
+                        bPos.z = pos.z + z;
+
+                        func(bPos, subRng);
+                    }
+        }
+
+        if (tracing)
+            traceWorker(cs, kernelClass, start);
+    }
+}
+
+// Whether launches are timed (profiling or tracing)
+static bool timeLaunches(
+    const ComputeSystem &cs
+) {
+    return cs.profiler != nullptr || cs.traceRecorder != nullptr;
+}
+
+// Report a finished launch to the profiler and trace recorder, whichever are set
+static void recordLaunch(
+    ComputeSystem &cs,
+    const KernelShape &shape,
+    long long elements,
+    std::chrono::steady_clock::time_point start
+) {
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+    if (cs.profiler != nullptr)
+        cs.profiler->addKernel(shape, elements, std::chrono::duration<double>(end - start).count());
+
+    if (cs.traceRecorder != nullptr)
+        cs.traceRecorder->record(kernelClassName(shape.kernelClass), "launch", start, end, shape.size.x, shape.size.y);
+}
+
+void ogmaneo::runKernel1(
+    ComputeSystem &cs,
+    const std::function<void(int, std::mt19937 &)> &func,
+    int size,
+    std::mt19937 &rng,
+    int batchSize,
+    int workPerElement
+) {
+    if (!timeLaunches(cs)) {
+        executeKernel1(cs, func, size, rng, batchSize, workPerElement, kernelOther);
+
+        return;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    executeKernel1(cs, func, size, rng, batchSize, workPerElement, kernelOther);
+
+    recordLaunch(cs, KernelShape(kernelOther, Int3(size, 1, 1), 0, workPerElement), size, start);
+}
+
+void ogmaneo::runKernel2(
+    ComputeSystem &cs,
+    const std::function<void(const Int2 &, std::mt19937 &)> &func,
+    const Int2 &size,
+    std::mt19937 &rng,
+    const Int2 &batchSize,
+    int workPerElement
+) {
+    if (!timeLaunches(cs)) {
+        executeKernel2(cs, func, size, rng, batchSize, workPerElement, kernelOther);
+
+        return;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    executeKernel2(cs, func, size, rng, batchSize, workPerElement, kernelOther);
+
+    recordLaunch(cs, KernelShape(kernelOther, Int3(size.x, size.y, 1), 0, workPerElement), size.x * size.y, start);
+}
+
+void ogmaneo::runKernel2(
+    ComputeSystem &cs,
+    const std::function<void(const Int2 &, std::mt19937 &)> &func,
+    const Int2 &size,
+    std::mt19937 &rng,
+    const Int2 &batchSize,
+    const KernelPartition* partition,
+    int workPerElement
+) {
+    if (partition == nullptr) {
+        runKernel2(cs, func, size, rng, batchSize, workPerElement);
+
+        return;
     }
+
+    if (!timeLaunches(cs)) {
+        executeKernel2(cs, func, size, rng, partition, workPerElement, kernelOther);
+
+        return;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    executeKernel2(cs, func, size, rng, partition, workPerElement, kernelOther);
+
+    recordLaunch(cs, KernelShape(kernelOther, Int3(size.x, size.y, 1), 0, workPerElement), size.x * size.y, start);
+}
+
+void ogmaneo::runKernel1(
+    ComputeSystem &cs,
+    const std::function<void(int, std::mt19937 &)> &func,
+    int size,
+    std::mt19937 &rng,
+    const KernelShape &shape
+) {
+    int workPerElement = std::max(1, shape.weightsPerColumn);
+
+    Int2 batchSize(cs.batchSize1, 1);
+
+    int trial = -1;
+
+    if (cs.kernelTuner != nullptr)
+        trial = cs.kernelTuner->beginLaunch(shape, batchSize);
+
+    // Only time launches someone is interested in
+    if (trial < 0 && !timeLaunches(cs)) {
+        executeKernel1(cs, func, size, rng, batchSize.x, workPerElement, shape.kernelClass);
+
+        return;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    executeKernel1(cs, func, size, rng, batchSize.x, workPerElement, shape.kernelClass);
+
+    if (trial >= 0)
+        cs.kernelTuner->endLaunch(shape, trial, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+    recordLaunch(cs, shape, size, start);
+}
+
+void ogmaneo::runKernel2(
+    ComputeSystem &cs,
+    const std::function<void(const Int2 &, std::mt19937 &)> &func,
+    const Int2 &size,
+    std::mt19937 &rng,
+    const KernelShape &shape,
+    const KernelPartition* partition
+) {
+    int workPerElement = std::max(1, shape.weightsPerColumn);
+
+    Int2 batchSize = cs.batchSize2;
+
+    int trial = -1;
+
+    if (partition == nullptr && cs.kernelTuner != nullptr)
+        trial = cs.kernelTuner->beginLaunch(shape, batchSize);
+
+    bool timed = trial >= 0 || timeLaunches(cs);
+
+    std::chrono::steady_clock::time_point start;
+
+    if (timed)
+        start = std::chrono::steady_clock::now();
+
+    if (partition != nullptr)
+        executeKernel2(cs, func, size, rng, partition, workPerElement, shape.kernelClass);
+    else
+        executeKernel2(cs, func, size, rng, batchSize, workPerElement, shape.kernelClass);
+
+    if (!timed)
+        return;
+
+    if (trial >= 0)
+        cs.kernelTuner->endLaunch(shape, trial, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+    recordLaunch(cs, shape, size.x * size.y, start);
+}
+
+void ogmaneo::runKernel3(
+    ComputeSystem &cs,
+    const std::function<void(const Int3 &, std::mt19937 &)> &func,
+    const Int3 &size,
+    std::mt19937 &rng,
+    const Int3 &batchSize,
+    int workPerElement
+) {
+    if (!timeLaunches(cs)) {
+        executeKernel3(cs, func, size, rng, batchSize, workPerElement, kernelOther);
+
+        return;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    executeKernel3(cs, func, size, rng, batchSize, workPerElement, kernelOther);
+
+    recordLaunch(cs, KernelShape(kernelOther, size, 0, workPerElement), size.x * size.y * size.z, start);
 }
 
 void ogmaneo::fillInt(
@@ -233,67 +693,95 @@ std::vector<const FloatBuffer*> ogmaneo::constGet(
     return vp;
 }
 
-void ogmaneo::initSMLocalRF(
-    const Int3 &inSize,
-    const Int3 &outSize,
-    int radius,
-    SparseMatrix &mat
+unsigned short ogmaneo::floatToHalf(
+    float x
 ) {
-    int numOut = outSize.x * outSize.y * outSize.z;
+    unsigned int bits;
 
-    // Projection constant
-    Float2 outToIn = Float2(static_cast<float>(inSize.x) / static_cast<float>(outSize.x),
-        static_cast<float>(inSize.y) / static_cast<float>(outSize.y));
+    std::memcpy(&bits, &x, sizeof(float));
 
-    int diam = radius * 2 + 1;
+    unsigned int sign = (bits >> 16) & 0x8000;
+    int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+    unsigned int mantissa = bits & 0x007fffff;
 
-    int numWeightsPerOutput = diam * diam * inSize.z;
+    // NaN/Inf
+    if (((bits >> 23) & 0xff) == 0xff)
+        return sign | 0x7c00 | (mantissa != 0 ? 0x0200 : 0);
 
-    int weightsSize = numOut * numWeightsPerOutput;
+    // Too small, flush to zero
+    if (exponent <= 0)
+        return sign;
 
-    mat.nonZeroValues.reserve(weightsSize);
+    // Too large, saturate to infinity
+    if (exponent >= 31)
+        return sign | 0x7c00;
 
-    mat.rowRanges.resize(numOut + 1);
+    unsigned int h = sign | (exponent << 10) | (mantissa >> 13);
 
-    mat.columnIndices.reserve(weightsSize);
+    // Round to nearest (carry may propagate into the exponent, which is correct)
+    if (mantissa & 0x00001000)
+        h++;
 
-    // Initialize weight matrix
-    for (int ox = 0; ox < outSize.x; ox++)
-        for (int oy = 0; oy < outSize.y; oy++) {
-            Int2 visiblePositionCenter = project(Int2(ox, oy), outToIn);
+    return h;
+}
 
-            // Lower corner
-            Int2 fieldLowerBound(visiblePositionCenter.x - radius, visiblePositionCenter.y - radius);
+float ogmaneo::halfToFloat(
+    unsigned short h
+) {
+    unsigned int sign = (h & 0x8000) << 16;
+    unsigned int exponent = (h >> 10) & 0x1f;
+    unsigned int mantissa = h & 0x03ff;
 
-            // Bounds of receptive field, clamped to input size
-            Int2 iterLowerBound(std::max(0, fieldLowerBound.x), std::max(0, fieldLowerBound.y));
-            Int2 iterUpperBound(std::min(inSize.x - 1, visiblePositionCenter.x + radius), std::min(inSize.y - 1, visiblePositionCenter.y + radius));
+    unsigned int bits;
 
-            for (int oz = 0; oz < outSize.z; oz++) {
-                Int3 outPos(ox, oy, oz);
+    if (exponent == 0)
+        bits = sign; // Zero (subnormals are never produced)
+    else if (exponent == 31)
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    else
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
 
-                int nonZeroInRow = 0;
+    float x;
 
-                for (int ix = iterLowerBound.x; ix <= iterUpperBound.x; ix++)
-                    for (int iy = iterLowerBound.y; iy <= iterUpperBound.y; iy++) {
-                        for (int iz = 0; iz < inSize.z; iz++) {
-                            Int3 inPos(ix, iy, iz);
+    std::memcpy(&x, &bits, sizeof(float));
 
-                            int inIndex = address3(inPos, inSize);
+    return x;
+}
 
-                            mat.nonZeroValues.push_back(0.0f);
-                            mat.columnIndices.push_back(inIndex);
-                            
-                            nonZeroInRow++;
-                        }
-                    }
+void ogmaneo::initSMLocalRF(
+    const Int3 &inSize,
+    const Int3 &outSize,
+    int radius,
+    SparseMatrix &mat
+) {
+    mat.clearDirty();
 
-                mat.rowRanges[address3(outPos, outSize)] = nonZeroInRow;
-            }
-        }
+    int numOutColumns = outSize.x * outSize.y;
+    int numOut = numOutColumns * outSize.z;
+
+    // Projection constant
+    Float2 outToIn = Float2(static_cast<float>(inSize.x) / static_cast<float>(outSize.x),
+        static_cast<float>(inSize.y) / static_cast<float>(outSize.y));
+
+    mat.rowRanges.resize(numOut + 1);
+
+    // Count nonzeros per row (same for every row of an output column)
+    #pragma omp parallel for
+    for (int i = 0; i < numOutColumns; i++) {
+        int ox = i / outSize.y;
+        int oy = i % outSize.y;
 
-    mat.nonZeroValues.shrink_to_fit();
-    mat.columnIndices.shrink_to_fit();
+        Int2 visiblePositionCenter = project(Int2(ox, oy), outToIn);
+
+        // Bounds of receptive field, clamped to input size
+        Int2 iterLowerBound(std::max(0, visiblePositionCenter.x - radius), std::max(0, visiblePositionCenter.y - radius));
+        Int2 iterUpperBound(std::min(inSize.x - 1, visiblePositionCenter.x + radius), std::min(inSize.y - 1, visiblePositionCenter.y + radius));
+
+        int nonZeroInRow = (iterUpperBound.x - iterLowerBound.x + 1) * (iterUpperBound.y - iterLowerBound.y + 1) * inSize.z;
+
+        for (int oz = 0; oz < outSize.z; oz++)
+            mat.rowRanges[address3(Int3(ox, oy, oz), outSize)] = nonZeroInRow;
+    }
 
     // Convert rowRanges from counts to cumulative counts
     int offset = 0;
@@ -308,10 +796,100 @@ void ogmaneo::initSMLocalRF(
 
     mat.rowRanges[numOut] = offset;
 
+    mat.nonZeroValues = std::vector<float>(offset, 0.0f);
+    mat.columnIndices.resize(offset);
+
+    // Fill column indices, each output column writes its own disjoint range
+    #pragma omp parallel for
+    for (int i = 0; i < numOutColumns; i++) {
+        int ox = i / outSize.y;
+        int oy = i % outSize.y;
+
+        Int2 visiblePositionCenter = project(Int2(ox, oy), outToIn);
+
+        Int2 iterLowerBound(std::max(0, visiblePositionCenter.x - radius), std::max(0, visiblePositionCenter.y - radius));
+        Int2 iterUpperBound(std::min(inSize.x - 1, visiblePositionCenter.x + radius), std::min(inSize.y - 1, visiblePositionCenter.y + radius));
+
+        for (int oz = 0; oz < outSize.z; oz++) {
+            int j = mat.rowRanges[address3(Int3(ox, oy, oz), outSize)];
+
+            for (int ix = iterLowerBound.x; ix <= iterUpperBound.x; ix++)
+                for (int iy = iterLowerBound.y; iy <= iterUpperBound.y; iy++) {
+                    for (int iz = 0; iz < inSize.z; iz++)
+                        mat.columnIndices[j++] = address3(Int3(ix, iy, iz), inSize);
+                }
+        }
+    }
+
     mat.rows = numOut;
     mat.columns = inSize.x * inSize.y * inSize.z;
 }
 
+MemoryUsage ogmaneo::estimateSMLocalRF(
+    const Int3 &inSize,
+    const Int3 &outSize,
+    int radius,
+    bool transpose
+) {
+    Float2 outToIn = Float2(static_cast<float>(inSize.x) / static_cast<float>(outSize.x),
+        static_cast<float>(inSize.y) / static_cast<float>(outSize.y));
+
+    // Same clamped receptive fields as initSMLocalRF
+    long long nonZeros = 0;
+
+    for (int ox = 0; ox < outSize.x; ox++)
+        for (int oy = 0; oy < outSize.y; oy++) {
+            Int2 visiblePositionCenter = project(Int2(ox, oy), outToIn);
+
+            Int2 iterLowerBound(std::max(0, visiblePositionCenter.x - radius), std::max(0, visiblePositionCenter.y - radius));
+            Int2 iterUpperBound(std::min(inSize.x - 1, visiblePositionCenter.x + radius), std::min(inSize.y - 1, visiblePositionCenter.y + radius));
+
+            nonZeros += static_cast<long long>(iterUpperBound.x - iterLowerBound.x + 1) * (iterUpperBound.y - iterLowerBound.y + 1) * inSize.z * outSize.z;
+        }
+
+    return SparseMatrix::estimateMemoryUsage(outSize.x * outSize.y * outSize.z, inSize.x * inSize.y * inSize.z, nonZeros, transpose);
+}
+
+// SplitMix64 step, used as a counter-based generator
+static inline unsigned long long splitMix64(
+    unsigned long long &state
+) {
+    unsigned long long z = (state += 0x9e3779b97f4a7c15ull);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+
+    return z ^ (z >> 31);
+}
+
+void ogmaneo::initSMUniform(
+    std::mt19937 &rng,
+    float lowerBound,
+    float upperBound,
+    SparseMatrix &mat
+) {
+    // Single draw from the generator, rows are then seeded from (seed, row) so the result does not depend on thread count
+    unsigned long long seed = (static_cast<unsigned long long>(rng()) << 32) | rng();
+
+    float range = upperBound - lowerBound;
+
+    #pragma omp parallel for
+    for (int i = 0; i < mat.rows; i++) {
+        unsigned long long rowState = seed;
+
+        rowState += static_cast<unsigned long long>(i) * 0xd1b54a32d192ed03ull;
+
+        rowState = splitMix64(rowState);
+
+        for (int j = mat.rowRanges[i]; j < mat.rowRanges[i + 1]; j++) {
+            // Top 24 bits to [0, 1)
+            float u = (splitMix64(rowState) >> 40) * (1.0f / 16777216.0f);
+
+            mat.nonZeroValues[j] = lowerBound + range * u;
+        }
+    }
+}
+
 void ogmaneo::writeSMToStream(
     std::ostream &os,
     const SparseMatrix &mat
@@ -331,6 +909,8 @@ void ogmaneo::readSMFromStream(
     std::istream &is,
     SparseMatrix &mat
 ) {
+    mat.clearDirty();
+
     is.read(reinterpret_cast<char*>(&mat.rows), sizeof(int));
     is.read(reinterpret_cast<char*>(&mat.columns), sizeof(int));
 
@@ -138,6 +138,143 @@ struct CircleBuffer {
     }
 };
 
+// --- Sum Tree ---
+
+// Binary tree of partial sums over a fixed number of leaves, for O(log n) proportional sampling
+struct SumTree {
+    std::vector<float> nodes; // Internal nodes followed by leaves, root at index 1
+    std::vector<float> minNodes; // Same layout, minimum over non-zero leaves (infinity if all are zero)
+    int numLeaves; // Number of leaves (power of 2)
+
+    SumTree()
+    :
+    numLeaves(0)
+    {}
+
+    void resize(
+        int size
+    );
+
+    // Set the value of a leaf and update its ancestors
+    void set(
+        int index,
+        float value
+    );
+
+    float get(
+        int index
+    ) const {
+        return nodes[numLeaves + index];
+    }
+
+    float total() const {
+        return nodes.empty() ? 0.0f : nodes[1];
+    }
+
+    // Smallest non-zero leaf, 0 if all leaves are zero
+    float minimum() const {
+        return total() > 0.0f ? minNodes[1] : 0.0f;
+    }
+
+    // Find the leaf in which the cumulative sum value falls
+    int find(
+        float value
+    ) const;
+};
+
+// --- Kernel Shapes ---
+
+// Kernel classes that get their own batch sizes
+enum KernelClass {
+    kernelSCForward = 0,
+    kernelSCLearn = 1,
+    kernelPForward = 2,
+    kernelPLearn = 3,
+    kernelAForward = 4,
+    kernelALearn = 5,
+    kernelCopy = 6,
+    kernelOther = 7 // Launches without a shape
+};
+
+// Describes a kernel launch so its batch size can be chosen per kernel class and layer shape
+struct KernelShape {
+    KernelClass kernelClass;
+    Int3 size; // Extent (x, y) and cells per column (z)
+    int radius; // Receptive field radius, 0 if none
+    int weightsPerColumn; // Approximate number of weights touched per column
+
+    KernelShape(
+        KernelClass kernelClass,
+        const Int3 &size,
+        int radius,
+        int weightsPerColumn
+    )
+    :
+    kernelClass(kernelClass),
+    size(size),
+    radius(radius),
+    weightsPerColumn(weightsPerColumn)
+    {}
+};
+
+// Shape of a copy of size elements
+inline KernelShape copyShape(
+    int size
+) {
+    return KernelShape(kernelCopy, Int3(size, 1, 1), 0, 1);
+}
+
+// --- Kernel Partitions ---
+
+// Split of the columns of a 2D kernel (in address2 order) into contiguous ranges of about equal cost
+struct KernelPartition {
+    Int2 size; // Extent the partition was made for
+    int numRanges; // Number of ranges requested (more than were made if there are fewer columns)
+    int numThreads; // Thread count the partition was made for
+    std::vector<int> starts; // First column of each range, followed by the number of columns
+
+    KernelPartition()
+    :
+    size(0, 0),
+    numRanges(0),
+    numThreads(0)
+    {}
+};
+
+// Add the number of weights of each hidden column to costs. Rows must be grouped by column (address3 order, any number of cells per column)
+void addColumnCosts(
+    const SparseMatrix &mat, // Weight matrix
+    int numColumns, // Number of hidden columns
+    std::vector<int> &costs // Cost per hidden column, must be numColumns in size
+);
+
+// Partition columns by cost
+void initPartition(
+    const Int2 &size, // Execution extent size
+    const std::vector<int> &costs, // Cost per column (address2 order)
+    int numRanges, // Number of ranges to make (at most one per column)
+    KernelPartition &partition // Partition to fill
+);
+
+// Partition the hidden columns of a layer by the number of weights in all its matrices, if cs.costBalanced.
+// Rebuilt only when the extent or thread count changes. Returns null if cost balancing is off
+const KernelPartition* updateHiddenPartition(
+    ComputeSystem &cs, // Compute system
+    const std::function<void(std::vector<SparseMatrix*> &)> &getMats, // Gets the weight matrices (rows grouped by hidden column), called only on rebuilds
+    const Int3 &hiddenSize, // Size of hidden layer
+    KernelPartition &partition // Cached partition
+);
+
+// Hidden column partition of a layer (SparseCoder, Predictor or Actor) for runKernel2, null unless cost balancing is enabled
+template <typename T>
+const KernelPartition* getHiddenPartition(
+    ComputeSystem &cs, // Compute system
+    T &layer, // Layer, provides getWeightMatrices and getHiddenSize
+    KernelPartition &partition // Partition cached in the layer
+) {
+    return updateHiddenPartition(cs, [&layer](std::vector<SparseMatrix*> &mats) { layer.getWeightMatrices(mats); }, layer.getHiddenSize(), partition);
+}
+
 // --- Kernel Executors ---
 
 void runKernel1(
@@ -145,7 +282,8 @@ void runKernel1(
     const std::function<void(int, std::mt19937 &rng)> &func, // Kernel function
     int size, // Execution extent size
     std::mt19937 &rng, // Generator
-    int batchSize // Batch size
+    int batchSize, // Batch size
+    int workPerElement = 1 // Estimated work per element, decides how many threads are used
 );
 
 void runKernel2(
@@ -153,7 +291,38 @@ void runKernel2(
     const std::function<void(const Int2 &, std::mt19937 &rng)> &func, // Kernel function
     const Int2 &size, // Execution extent size
     std::mt19937 &rng, // Generator
-    const Int2 &batchSize // Batch size
+    const Int2 &batchSize, // Batch size
+    int workPerElement = 1 // Estimated work per element, decides how many threads are used
+);
+
+// Run 2D kernel over a cost partition, or in batchSize tiles if partition is null
+void runKernel2(
+    ComputeSystem &cs, // Compute system
+    const std::function<void(const Int2 &, std::mt19937 &rng)> &func, // Kernel function
+    const Int2 &size, // Execution extent size
+    std::mt19937 &rng, // Generator
+    const Int2 &batchSize, // Batch size
+    const KernelPartition* partition, // Partition of size, may be null
+    int workPerElement = 1 // Estimated work per element, decides how many threads are used
+);
+
+// Run 1D kernel with the batch size chosen by cs.kernelTuner, or cs.batchSize1 without one
+void runKernel1(
+    ComputeSystem &cs, // Compute system
+    const std::function<void(int, std::mt19937 &rng)> &func, // Kernel function
+    int size, // Execution extent size
+    std::mt19937 &rng, // Generator
+    const KernelShape &shape // Shape used to look up the batch size
+);
+
+// Run 2D kernel over a cost partition if given, otherwise in tiles chosen by cs.kernelTuner (cs.batchSize2 without one)
+void runKernel2(
+    ComputeSystem &cs, // Compute system
+    const std::function<void(const Int2 &, std::mt19937 &rng)> &func, // Kernel function
+    const Int2 &size, // Execution extent size
+    std::mt19937 &rng, // Generator
+    const KernelShape &shape, // Shape used to look up the tile
+    const KernelPartition* partition = nullptr // Partition of size, may be null
 );
 
 // Run 3D kernel
@@ -162,7 +331,8 @@ void runKernel3(
     const std::function<void(const Int3 &, std::mt19937 &rng)> &func, // Kernel function
     const Int3 &size, // Execution extent size
     std::mt19937 &rng, // Generator
-    const Int3 &batchSize // Batch size
+    const Int3 &batchSize, // Batch size
+    int workPerElement = 1 // Estimated work per element, decides how many threads are used
 );
 
 // --- Basic Kernels ---
@@ -306,6 +476,17 @@ inline float sigmoid(
     return 1.0f / (1.0f + std::exp(-x));
 }
 
+// --- Half Precision ---
+
+// Convert to IEEE half (binary16), rounds to nearest, flushes subnormals to zero
+unsigned short floatToHalf(
+    float x
+);
+
+float halfToFloat(
+    unsigned short h
+);
+
 // --- Serialization ---
 
 template <typename T>
@@ -350,6 +531,22 @@ void initSMLocalRF(
     SparseMatrix &mat // Matrix to fill
 );
 
+// Memory a matrix made by initSMLocalRF will hold, without generating it
+MemoryUsage estimateSMLocalRF(
+    const Int3 &inSize, // Size of input field
+    const Int3 &outSize, // Size of output field
+    int radius, // Radius of output onto input
+    bool transpose // Whether the transpose will be generated
+);
+
+// Fill nonzero values with uniform random values in [lowerBound, upperBound), in parallel
+void initSMUniform(
+    std::mt19937 &rng, // Generator to draw the seed from
+    float lowerBound, // Lower bound of values
+    float upperBound, // Upper bound of values
+    SparseMatrix &mat // Matrix to fill (topology must already exist)
+);
+
 // --- Sparse Matrix Serialization ---
 
 void writeSMToStream(
@@ -9,10 +9,53 @@
 #include "Hierarchy.h"
 
 #include <algorithm>
+#include <fstream>
 #include <assert.h>
 
 using namespace ogmaneo;
 
+// Start of a profiled layer stage, only taken when profiling or tracing
+static std::chrono::steady_clock::time_point profileStart(
+    const ComputeSystem &cs
+) {
+    return cs.profiler != nullptr || cs.traceRecorder != nullptr ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+}
+
+static void profileEnd(
+    ComputeSystem &cs,
+    std::chrono::steady_clock::time_point start,
+    int l,
+    LayerStage stage,
+    int index
+) {
+    if (cs.profiler == nullptr && cs.traceRecorder == nullptr)
+        return;
+
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+    if (cs.profiler != nullptr)
+        cs.profiler->addLayer(l, stage, index, std::chrono::duration<double>(end - start).count());
+
+    if (cs.traceRecorder != nullptr)
+        cs.traceRecorder->record(layerStageName(stage), "layer", start, end, l, index);
+}
+
+// Start of a step latency measurement, only taken when latencies are collected
+static std::chrono::steady_clock::time_point latencyStart(
+    const ComputeSystem &cs
+) {
+    return cs.stepLatencies != nullptr ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+}
+
+static void recordLatency(
+    ComputeSystem &cs,
+    LatencyHistogram StepLatencies::* histogram,
+    std::chrono::steady_clock::time_point start
+) {
+    if (cs.stepLatencies != nullptr)
+        (cs.stepLatencies->*histogram).record(std::chrono::steady_clock::now() - start);
+}
+
 void Hierarchy::initRandom(
     ComputeSystem &cs,
     const std::vector<Int3> &inputSizes,
@@ -101,7 +144,7 @@ void Hierarchy::initRandom(
                 else if (inputTypes[p] == InputType::action) {
                     aLayers[p] = std::make_unique<Actor>();
 
-                    aLayers[p]->initRandom(cs, inputSizes[p], layerDescs[l].historyCapacity, aVisibleLayerDescs);
+                    aLayers[p]->initRandom(cs, inputSizes[p], layerDescs[l].historyCapacity, aVisibleLayerDescs, layerDescs[l].compressHistory);
                 }
             }
         }
@@ -144,6 +187,10 @@ void Hierarchy::initRandom(
         // Create the sparse coding layer
         scLayers[l].initRandom(cs, layerDescs[l].hiddenSize, scVisibleLayerDescs);
     }
+
+    markHistoriesChanged();
+
+    stateSize = computeStateSize();
 }
 
 const Hierarchy &Hierarchy::operator=(
@@ -157,6 +204,8 @@ const Hierarchy &Hierarchy::operator=(
     ticksPerUpdate = other.ticksPerUpdate;
     inputSizes = other.inputSizes;
     histories = other.histories;
+    historyPushes = other.historyPushes;
+    stateSize = other.stateSize;
 
     pLayers.resize(other.pLayers.size());
     
@@ -165,7 +214,9 @@ const Hierarchy &Hierarchy::operator=(
 
         for (int v = 0; v < pLayers[l].size(); v++) {
             if (other.pLayers[l][v] != nullptr) {
-                pLayers[l][v] = std::make_unique<Predictor>();
+                // Reuse existing layers so repeated assignment (e.g. snapshots) keeps buffer capacity
+                if (pLayers[l][v] == nullptr)
+                    pLayers[l][v] = std::make_unique<Predictor>();
 
                 (*pLayers[l][v]) = (*other.pLayers[l][v]);
             }
@@ -178,7 +229,8 @@ const Hierarchy &Hierarchy::operator=(
     
     for (int v = 0; v < aLayers.size(); v++) {
         if (other.aLayers[v] != nullptr) {
-            aLayers[v] = std::make_unique<Actor>();
+            if (aLayers[v] == nullptr)
+                aLayers[v] = std::make_unique<Actor>();
 
             (*aLayers[v]) = (*other.aLayers[v]);
         }
@@ -195,9 +247,37 @@ void Hierarchy::step(
     bool learnEnabled,
     float reward,
     bool mimic
+) {
+    // Learning of a previous deferred step goes first
+    if (learnPending)
+        learnDeferred(cs);
+
+    std::chrono::steady_clock::time_point start = latencyStart(cs);
+
+    step(cs, inputCs, learnEnabled, reward, mimic, modeNormal);
+
+    recordLatency(cs, learnEnabled ? &StepLatencies::learning : &StepLatencies::inference, start);
+    recordLatency(cs, &StepLatencies::step, start);
+}
+
+void Hierarchy::step(
+    ComputeSystem &cs,
+    const std::vector<const IntBuffer*> &inputCs,
+    bool learnEnabled,
+    float reward,
+    bool mimic,
+    StepMode mode
 ) {
     assert(inputCs.size() == inputSizes.size());
 
+    // Deferred steps learn later, in learnDeferred
+    bool learnNow = learnEnabled && mode == modeNormal;
+
+    // Per layer update times
+    bool timeLayers = cs.stepLatencies != nullptr;
+
+    std::vector<std::chrono::steady_clock::duration> layerTimes(timeLayers ? scLayers.size() : 0, std::chrono::steady_clock::duration::zero());
+
     // First tick is always 0
     ticks[0] = 0;
 
@@ -208,9 +288,11 @@ void Hierarchy::step(
         histories.front()[i].pushFront();
 
         // Copy
-        runKernel1(cs, std::bind(copyInt, std::placeholders::_1, std::placeholders::_2, inputCs[i], &histories.front()[i].front()), inputCs[i]->size(), cs.rng, cs.batchSize1);
+        runKernel1(cs, std::bind(copyInt, std::placeholders::_1, std::placeholders::_2, inputCs[i], &histories.front()[i].front()), inputCs[i]->size(), cs.rng, copyShape(inputCs[i]->size()));
     }
 
+    countHistoryPush(0);
+
     // Set all updates to no update, will be set to true if an update occurred later
     updates.clear();
     updates.resize(scLayers.size(), false);
@@ -232,8 +314,18 @@ void Hierarchy::step(
                     layerInputCs[t + histories[l][i].size() * i] = &histories[l][i][t]; // t is consecutive dimension
             }
 
-            // Activate sparse coder
-            scLayers[l].step(cs, layerInputCs, learnEnabled);
+            std::chrono::steady_clock::time_point start = timeLayers ? std::chrono::steady_clock::now() : profileStart(cs);
+
+            // Activate sparse coder, a deferred step leaves learning and prevs to learnDeferred
+            if (mode == modeDeferred)
+                scLayers[l].activate(cs, layerInputCs);
+            else
+                scLayers[l].step(cs, layerInputCs, learnNow);
+
+            profileEnd(cs, start, l, stageSC, 0);
+
+            if (timeLayers)
+                layerTimes[l] += std::chrono::steady_clock::now() - start;
 
             // Add to next layer's history
             if (l < scLayers.size() - 1) {
@@ -241,8 +333,10 @@ void Hierarchy::step(
 
                 histories[lNext].front().pushFront();
 
+                countHistoryPush(lNext);
+
                 // Copy
-                runKernel1(cs, std::bind(copyInt, std::placeholders::_1, std::placeholders::_2, &scLayers[l].getHiddenCs(), &histories[lNext].front().front()), scLayers[l].getHiddenCs().size(), cs.rng, cs.batchSize1);
+                runKernel1(cs, std::bind(copyInt, std::placeholders::_1, std::placeholders::_2, &scLayers[l].getHiddenCs(), &histories[lNext].front().front()), scLayers[l].getHiddenCs().size(), cs.rng, copyShape(scLayers[l].getHiddenCs().size()));
 
                 ticks[lNext]++;
             }
@@ -252,6 +346,8 @@ void Hierarchy::step(
     // Backward
     for (int l = scLayers.size() - 1; l >= 0; l--) {
         if (updates[l]) {
+            std::chrono::steady_clock::time_point layerStart = latencyStart(cs);
+
             // Feed back is current layer state and next higher layer prediction
             std::vector<const IntBuffer*> feedBackCs(l < scLayers.size() - 1 ? 2 : 1);
 
@@ -266,22 +362,393 @@ void Hierarchy::step(
             // Step actor layers
             for (int p = 0; p < pLayers[l].size(); p++) {
                 if (pLayers[l][p] != nullptr) {
-                    if (learnEnabled)
+                    std::chrono::steady_clock::time_point start = profileStart(cs);
+
+                    if (learnNow)
                         pLayers[l][p]->learn(cs, l == 0 ? inputCs[p] : &histories[l].front()[p]);
+                    else if (mode == modeDeferred) {
+                        // Keep what learning needs, activation overwrites it
+                        DeferredPredictor &dp = deferredPredictors[l][p];
+
+                        dp.hiddenActivations = pLayers[l][p]->hiddenActivations;
+
+                        dp.inputCsPrev.resize(pLayers[l][p]->getNumVisibleLayers());
+
+                        for (int v = 0; v < pLayers[l][p]->getNumVisibleLayers(); v++)
+                            dp.inputCsPrev[v] = pLayers[l][p]->visibleLayers[v].inputCsPrev;
+                    }
 
                     pLayers[l][p]->activate(cs, feedBackCs);
+
+                    profileEnd(cs, start, l, stagePredictor, p);
                 }
             }
 
             if (l == 0) {
                 // Step actors
                 for (int p = 0; p < aLayers.size(); p++) {
-                    if (aLayers[p] != nullptr)
-                        aLayers[p]->step(cs, feedBackCs, inputCs[p], reward, learnEnabled, mimic);
+                    if (aLayers[p] != nullptr) {
+                        std::chrono::steady_clock::time_point start = profileStart(cs);
+
+                        aLayers[p]->step(cs, feedBackCs, inputCs[p], reward, learnNow, mimic);
+
+                        profileEnd(cs, start, l, stageActor, p);
+                    }
+                }
+            }
+
+            if (timeLayers)
+                layerTimes[l] += std::chrono::steady_clock::now() - layerStart;
+        }
+    }
+
+    if (timeLayers) {
+        if (cs.stepLatencies->layers.size() < scLayers.size())
+            cs.stepLatencies->layers.resize(scLayers.size());
+
+        for (int l = 0; l < scLayers.size(); l++) {
+            if (updates[l])
+                cs.stepLatencies->layers[l].record(layerTimes[l]);
+        }
+    }
+}
+
+void Hierarchy::stepPipelined(
+    ComputeSystem &cs,
+    const std::vector<const IntBuffer*> &inputCs,
+    bool learnEnabled,
+    float reward,
+    bool mimic
+) {
+    // Learning of a previous deferred step goes first
+    if (learnPending)
+        learnDeferred(cs);
+
+    assert(inputCs.size() == inputSizes.size());
+
+    std::chrono::steady_clock::time_point stepStart = latencyStart(cs);
+
+    int numLayers = scLayers.size();
+
+    // First tick is always 0
+    ticks[0] = 0;
+
+    // Add input to first layer history
+    for (int i = 0; i < inputSizes.size(); i++) {
+        assert(inputSizes[i].x * inputSizes[i].y == inputCs[i]->size());
+
+        histories.front()[i].pushFront();
+
+        runKernel1(cs, std::bind(copyInt, std::placeholders::_1, std::placeholders::_2, inputCs[i], &histories.front()[i].front()), inputCs[i]->size(), cs.rng, copyShape(inputCs[i]->size()));
+    }
+
+    countHistoryPush(0);
+
+    // Decide all updates up front, from what previous steps handed over
+    updates.clear();
+    updates.resize(numLayers, false);
+
+    for (int l = 0; l < numLayers; l++) {
+        if (l == 0 || ticks[l] >= ticksPerUpdate[l]) {
+            ticks[l] = 0;
+
+            updates[l] = true;
+        }
+    }
+
+    // Feed back from the layer above, as left by the previous step (layers are busy during this one)
+    pipelineFeedBackCs.resize(numLayers);
+
+    for (int l = 0; l < numLayers - 1; l++) {
+        assert(pLayers[l + 1][ticksPerUpdate[l + 1] - 1 - ticks[l + 1]] != nullptr);
+
+        pipelineFeedBackCs[l] = pLayers[l + 1][ticksPerUpdate[l + 1] - 1 - ticks[l + 1]]->getHiddenCs();
+    }
+
+    // Each layer keeps its own RNG so layers can run concurrently, seeded once from cs.rng. Other settings are shared
+    for (int l = pipelineCS.size(); l < numLayers; l++) {
+        pipelineCS.push_back(ComputeSystem());
+        pipelineCS.back().rng.seed(cs.rng());
+    }
+
+    for (int l = 0; l < numLayers; l++)
+        pipelineCS[l].copySettings(cs);
+
+    if (cs.stepLatencies != nullptr && cs.stepLatencies->layers.size() < numLayers)
+        cs.stepLatencies->layers.resize(numLayers);
+
+    pipelineLayers.clear();
+
+    for (int l = 0; l < numLayers; l++) {
+        if (updates[l])
+            pipelineLayers.push_back(l);
+    }
+
+    int numUpdated = pipelineLayers.size();
+
+    // Split the threads over the updated layers, the first layers (with predictors and actors) get the remainder
+    int maxThreads = omp_get_max_threads();
+    int outerThreads = std::min(numUpdated, maxThreads);
+
+    // Layer kernels are parallel regions nested in the layer loop
+    int maxActiveLevels = omp_get_max_active_levels();
+
+    if (outerThreads > 1)
+        omp_set_max_active_levels(std::max(2, maxActiveLevels));
+
+    // Layers only read their own history and the feed back copies, and only write their own state
+    #pragma omp parallel for schedule(static, 1) num_threads(outerThreads) if(outerThreads > 1)
+    for (int j = 0; j < numUpdated; j++) {
+        int l = pipelineLayers[j];
+
+        // Only affects regions started by this thread
+        omp_set_num_threads(std::max(1, maxThreads / outerThreads + (j < maxThreads % outerThreads ? 1 : 0)));
+
+        ComputeSystem &lcs = pipelineCS[l];
+
+        std::chrono::steady_clock::time_point layerStart = latencyStart(lcs);
+
+        std::vector<const IntBuffer*> layerInputCs(histories[l].size() * histories[l][0].size());
+
+        for (int i = 0; i < histories[l].size(); i++) {
+            for (int t = 0; t < histories[l][i].size(); t++)
+                layerInputCs[t + histories[l][i].size() * i] = &histories[l][i][t]; // t is consecutive dimension
+        }
+
+        std::chrono::steady_clock::time_point start = profileStart(lcs);
+
+        scLayers[l].step(lcs, layerInputCs, learnEnabled);
+
+        profileEnd(lcs, start, l, stageSC, 0);
+
+        std::vector<const IntBuffer*> feedBackCs(l < numLayers - 1 ? 2 : 1);
+
+        feedBackCs[0] = &scLayers[l].getHiddenCs();
+
+        if (l < numLayers - 1)
+            feedBackCs[1] = &pipelineFeedBackCs[l];
+
+        for (int p = 0; p < pLayers[l].size(); p++) {
+            if (pLayers[l][p] != nullptr) {
+                std::chrono::steady_clock::time_point start = profileStart(lcs);
+
+                if (learnEnabled)
+                    pLayers[l][p]->learn(lcs, l == 0 ? inputCs[p] : &histories[l].front()[p]);
+
+                pLayers[l][p]->activate(lcs, feedBackCs);
+
+                profileEnd(lcs, start, l, stagePredictor, p);
+            }
+        }
+
+        if (l == 0) {
+            for (int p = 0; p < aLayers.size(); p++) {
+                if (aLayers[p] != nullptr) {
+                    std::chrono::steady_clock::time_point start = profileStart(lcs);
+
+                    aLayers[p]->step(lcs, feedBackCs, inputCs[p], reward, learnEnabled, mimic);
+
+                    profileEnd(lcs, start, l, stageActor, p);
+                }
+            }
+        }
+
+        // Each layer has its own histogram
+        if (lcs.stepLatencies != nullptr)
+            lcs.stepLatencies->layers[l].record(std::chrono::steady_clock::now() - layerStart);
+    }
+
+    if (outerThreads > 1)
+        omp_set_max_active_levels(maxActiveLevels);
+
+    // Hand outputs over to the next layer, consumed in the next step
+    for (int l = 0; l < numLayers - 1; l++) {
+        if (updates[l]) {
+            int lNext = l + 1;
+
+            histories[lNext].front().pushFront();
+
+            countHistoryPush(lNext);
+
+            runKernel1(cs, std::bind(copyInt, std::placeholders::_1, std::placeholders::_2, &scLayers[l].getHiddenCs(), &histories[lNext].front().front()), scLayers[l].getHiddenCs().size(), cs.rng, copyShape(scLayers[l].getHiddenCs().size()));
+
+            ticks[lNext]++;
+        }
+    }
+
+    recordLatency(cs, learnEnabled ? &StepLatencies::learning : &StepLatencies::inference, stepStart);
+    recordLatency(cs, &StepLatencies::step, stepStart);
+}
+
+void Hierarchy::stepDeferred(
+    ComputeSystem &cs,
+    const std::vector<const IntBuffer*> &inputCs,
+    float reward,
+    bool mimic
+) {
+    std::chrono::steady_clock::time_point start = latencyStart(cs);
+
+    beginDeferred(cs, inputCs, reward, mimic);
+
+    recordLatency(cs, &StepLatencies::step, start);
+}
+
+void Hierarchy::beginDeferred(
+    ComputeSystem &cs,
+    const std::vector<const IntBuffer*> &inputCs,
+    float reward,
+    bool mimic
+) {
+    // Learning of a previous deferred step goes first
+    if (learnPending)
+        learnDeferred(cs);
+
+    std::chrono::steady_clock::time_point start = latencyStart(cs);
+
+    deferredPredictors.resize(scLayers.size());
+
+    for (int l = 0; l < scLayers.size(); l++)
+        deferredPredictors[l].resize(pLayers[l].size());
+
+    step(cs, inputCs, true, reward, mimic, modeDeferred);
+
+    deferredMimic = mimic;
+    learnPending = true;
+
+    recordLatency(cs, &StepLatencies::inference, start);
+}
+
+void Hierarchy::learnDeferred(
+    ComputeSystem &cs
+) {
+    learnDeferred(cs, nullptr);
+}
+
+void Hierarchy::stepBudgeted(
+    ComputeSystem &cs,
+    const std::vector<const IntBuffer*> &inputCs,
+    float budget,
+    float reward,
+    bool mimic
+) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::chrono::steady_clock::time_point deadline = start
+        + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(budget));
+
+    beginDeferred(cs, inputCs, reward, mimic);
+
+    learnDeferred(cs, &deadline);
+
+    recordLatency(cs, &StepLatencies::step, start);
+}
+
+void Hierarchy::learnDeferred(
+    ComputeSystem &cs,
+    const std::chrono::steady_clock::time_point* deadline
+) {
+    if (!learnPending)
+        return;
+
+    std::chrono::steady_clock::time_point start = latencyStart(cs);
+
+    // Checked before each unit of work (a layer update or a replay iteration), units are not interrupted
+    auto inBudget = [deadline]() {
+        return deadline == nullptr || std::chrono::steady_clock::now() < *deadline;
+    };
+
+    // Same order as in a normal step, with the inputs of the deferred step (histories have not moved since)
+    for (int l = 0; l < scLayers.size(); l++) {
+        if (updates[l]) {
+            if (inBudget()) {
+                std::vector<const IntBuffer*> layerInputCs(histories[l].size() * histories[l][0].size());
+
+                for (int i = 0; i < histories[l].size(); i++) {
+                    for (int t = 0; t < histories[l][i].size(); t++)
+                        layerInputCs[t + histories[l][i].size() * i] = &histories[l][i][t];
+                }
+
+                std::chrono::steady_clock::time_point start = profileStart(cs);
+
+                scLayers[l].learn(cs, layerInputCs);
+
+                profileEnd(cs, start, l, stageSC, 0);
+
+                budgetStats.scLearned++;
+            }
+            else
+                budgetStats.scSkipped++;
+
+            // Always needed for the next step
+            scLayers[l].updatePrevs(cs);
+        }
+    }
+
+    for (int l = scLayers.size() - 1; l >= 0; l--) {
+        if (updates[l]) {
+            for (int p = 0; p < pLayers[l].size(); p++) {
+                if (pLayers[l][p] != nullptr) {
+                    if (!inBudget()) {
+                        budgetStats.pSkipped++;
+
+                        continue;
+                    }
+
+                    std::chrono::steady_clock::time_point start = profileStart(cs);
+
+                    DeferredPredictor &dp = deferredPredictors[l][p];
+
+                    // Learn with the activation of the previous step, targets are the inputs of the deferred step
+                    std::swap(dp.hiddenActivations, pLayers[l][p]->hiddenActivations);
+
+                    for (int v = 0; v < pLayers[l][p]->getNumVisibleLayers(); v++)
+                        std::swap(dp.inputCsPrev[v], pLayers[l][p]->visibleLayers[v].inputCsPrev);
+
+                    pLayers[l][p]->learn(cs, l == 0 ? &histories[0][p].front() : &histories[l].front()[p]);
+
+                    std::swap(dp.hiddenActivations, pLayers[l][p]->hiddenActivations);
+
+                    for (int v = 0; v < pLayers[l][p]->getNumVisibleLayers(); v++)
+                        std::swap(dp.inputCsPrev[v], pLayers[l][p]->visibleLayers[v].inputCsPrev);
+
+                    profileEnd(cs, start, l, stagePredictor, p);
+
+                    budgetStats.pLearned++;
+                }
+            }
+        }
+    }
+
+    for (int p = 0; p < aLayers.size(); p++) {
+        if (aLayers[p] != nullptr) {
+            std::chrono::steady_clock::time_point start = profileStart(cs);
+
+            if (deadline == nullptr) {
+                aLayers[p]->learn(cs, deferredMimic, aLayers[p]->historyIters);
+
+                budgetStats.aItersLearned += aLayers[p]->historyIters;
+            }
+            else {
+                for (int it = 0; it < aLayers[p]->historyIters; it++) {
+                    if (!inBudget()) {
+                        budgetStats.aItersSkipped += aLayers[p]->historyIters - it;
+
+                        break;
+                    }
+
+                    aLayers[p]->learn(cs, deferredMimic, 1);
+
+                    budgetStats.aItersLearned++;
                 }
             }
+
+            profileEnd(cs, start, 0, stageActor, p);
         }
     }
+
+    learnPending = false;
+
+    recordLatency(cs, &StepLatencies::learning, start);
 }
 
 void Hierarchy::writeToStream(
@@ -344,7 +811,8 @@ void Hierarchy::writeToStream(
 }
 
 void Hierarchy::readFromStream(
-    std::istream &is
+    std::istream &is,
+    TopologyCache* topologyCache
 ) {
     int numLayers;
     is.read(reinterpret_cast<char*>(&numLayers), sizeof(int));
@@ -395,7 +863,7 @@ void Hierarchy::readFromStream(
                 readBufferFromStream(is, &histories[l][i][t]);
         }
 
-        scLayers[l].readFromStream(is);
+        scLayers[l].readFromStream(is, topologyCache);
         
         pLayers[l].resize(l == 0 ? inputSizes.size() : ticksPerUpdate[l]);
 
@@ -407,7 +875,7 @@ void Hierarchy::readFromStream(
 
             if (exists) {
                 pLayers[l][v] = std::make_unique<Predictor>();
-                pLayers[l][v]->readFromStream(is);
+                pLayers[l][v]->readFromStream(is, topologyCache);
             }
             else
                 pLayers[l][v] = nullptr;
@@ -424,70 +892,940 @@ void Hierarchy::readFromStream(
 
         if (exists) {
             aLayers[v] = std::make_unique<Actor>();
-            aLayers[v]->readFromStream(is);
+            aLayers[v]->readFromStream(is, topologyCache);
         }
         else
             aLayers[v] = nullptr;
     }
+
+    markHistoriesChanged();
+
+    stateSize = computeStateSize();
 }
 
-void Hierarchy::getState(
-    State &state
+void Hierarchy::forkContext(
+    RolloutContext &ctx
 ) const {
     int numLayers = scLayers.size();
+    int numInputs = inputSizes.size();
+
+    // Assignment keeps the context's buffers when sizes match
+    ctx.histories = histories;
+    ctx.updates = updates;
+    ctx.ticks = ticks;
 
-    state.hiddenCs.resize(numLayers);
-    state.hiddenCsPrev.resize(numLayers);
-    state.predHiddenCs.resize(numLayers);
-    state.predInputCsPrev.resize(numLayers);
+    ctx.scHiddenCs.resize(numLayers);
+    ctx.pHiddenCs.resize(numLayers);
+    ctx.pHiddenActivations.resize(numLayers);
 
     for (int l = 0; l < numLayers; l++) {
-        state.hiddenCs[l] = scLayers[l].getHiddenCs();
-        state.hiddenCsPrev[l] = scLayers[l].getHiddenCsPrev();
+        ctx.scHiddenCs[l] = scLayers[l].getHiddenCs();
 
-        state.predHiddenCs[l].resize(pLayers[l].size());
-        state.predInputCsPrev[l].resize(pLayers[l].size());
+        ctx.pHiddenCs[l].resize(pLayers[l].size());
+        ctx.pHiddenActivations[l].resize(pLayers[l].size());
 
-        for (int j = 0; j < pLayers[l].size(); j++) {
-            if (pLayers[l][j] != nullptr) {
-                state.predHiddenCs[l][j] = pLayers[l][j]->getHiddenCs();
+        for (int p = 0; p < pLayers[l].size(); p++) {
+            if (pLayers[l][p] != nullptr) {
+                ctx.pHiddenCs[l][p] = pLayers[l][p]->getHiddenCs();
+                ctx.pHiddenActivations[l][p] = pLayers[l][p]->hiddenActivations;
+            }
+        }
+    }
 
-                state.predInputCsPrev[l][j].resize(pLayers[l][j]->getNumVisibleLayers());
+    ctx.aHiddenCs.resize(numInputs);
+    ctx.aHiddenValues.resize(numInputs);
+    ctx.aHiddenActivations.resize(numInputs);
 
-                for (int v = 0; v < pLayers[l][j]->getNumVisibleLayers(); v++)
-                    state.predInputCsPrev[l][j][v] = pLayers[l][j]->getVisibleLayer(v).inputCsPrev;
-            }
+    for (int i = 0; i < numInputs; i++) {
+        if (aLayers[i] != nullptr) {
+            const Int3 &aHiddenSize = aLayers[i]->getHiddenSize();
+
+            ctx.aHiddenCs[i] = aLayers[i]->getHiddenCs();
+            ctx.aHiddenValues[i] = aLayers[i]->getHiddenValues();
+            ctx.aHiddenActivations[i].resize(aHiddenSize.x * aHiddenSize.y * aHiddenSize.z);
         }
     }
 
-    state.histories = histories;
-    state.ticks = ticks;
-    state.updates = updates;
+    ctx.inputCs.resize(numInputs);
+    ctx.inputCsPtrs.resize(numInputs);
 }
 
-void Hierarchy::setState(
-    const State &state
-) {
-    int numLayers = scLayers.size();
+void Hierarchy::rolloutStep(
+    RolloutContext &ctx,
+    const std::vector<const IntBuffer*> &inputCs
+) const {
+    // Same as step without learning, on the context's state
+    ctx.ticks[0] = 0;
 
-    for (int l = 0; l < numLayers; l++) {
-        scLayers[l].hiddenCs = state.hiddenCs[l];
-        scLayers[l].hiddenCsPrev = state.hiddenCsPrev[l];
+    for (int i = 0; i < inputSizes.size(); i++) {
+        ctx.histories.front()[i].pushFront();
 
-        for (int i = 0; i < histories[l].size(); i++)
-            histories[l][i] = state.histories[l][i];
+        ctx.histories.front()[i].front() = *inputCs[i];
+    }
+
+    std::fill(ctx.updates.begin(), ctx.updates.end(), false);
+
+    // Forward
+    for (int l = 0; l < scLayers.size(); l++) {
+        if (l == 0 || ctx.ticks[l] >= ticksPerUpdate[l]) {
+            ctx.ticks[l] = 0;
+
+            ctx.updates[l] = true;
+
+            std::vector<const IntBuffer*> layerInputCs(ctx.histories[l].size() * ctx.histories[l][0].size());
+
+            for (int i = 0; i < ctx.histories[l].size(); i++) {
+                for (int t = 0; t < ctx.histories[l][i].size(); t++)
+                    layerInputCs[t + ctx.histories[l][i].size() * i] = &ctx.histories[l][i][t];
+            }
+
+            scLayers[l].activate(ctx.cs, layerInputCs, &ctx.scHiddenCs[l]);
+
+            if (l < scLayers.size() - 1) {
+                int lNext = l + 1;
+
+                ctx.histories[lNext].front().pushFront();
+
+                ctx.histories[lNext].front().front() = ctx.scHiddenCs[l];
+
+                ctx.ticks[lNext]++;
+            }
+        }
+    }
+
+    // Backward
+    for (int l = scLayers.size() - 1; l >= 0; l--) {
+        if (ctx.updates[l]) {
+            std::vector<const IntBuffer*> feedBackCs(l < scLayers.size() - 1 ? 2 : 1);
+
+            feedBackCs[0] = &ctx.scHiddenCs[l];
+
+            if (l < scLayers.size() - 1)
+                feedBackCs[1] = &ctx.pHiddenCs[l + 1][ticksPerUpdate[l + 1] - 1 - ctx.ticks[l + 1]];
+
+            for (int p = 0; p < pLayers[l].size(); p++) {
+                if (pLayers[l][p] != nullptr)
+                    pLayers[l][p]->activate(ctx.cs, feedBackCs, &ctx.pHiddenCs[l][p], &ctx.pHiddenActivations[l][p]);
+            }
+
+            if (l == 0) {
+                for (int p = 0; p < aLayers.size(); p++) {
+                    if (aLayers[p] != nullptr)
+                        aLayers[p]->activate(ctx.cs, feedBackCs, &ctx.aHiddenCs[p], &ctx.aHiddenValues[p], &ctx.aHiddenActivations[p]);
+                }
+            }
+        }
+    }
+}
+
+void Hierarchy::rolloutSteps(
+    RolloutContext &ctx,
+    int numSteps,
+    const std::vector<std::vector<const IntBuffer*>> &inputCs,
+    std::vector<std::vector<IntBuffer>> &trajectory,
+    std::vector<FloatBuffer>* values
+) const {
+    int numInputs = inputSizes.size();
+
+    trajectory.resize(numSteps);
+
+    if (values != nullptr)
+        values->resize(numSteps);
+
+    for (int t = 0; t < numSteps; t++) {
+        assert(t >= inputCs.size() || inputCs[t].size() == numInputs);
+
+        for (int i = 0; i < numInputs; i++) {
+            if (t < inputCs.size() && inputCs[t][i] != nullptr)
+                ctx.inputCsPtrs[i] = inputCs[t][i];
+            else {
+                // Copy, as predictions are overwritten during the step
+                ctx.inputCs[i] = getPredictionCs(ctx, i);
+
+                ctx.inputCsPtrs[i] = &ctx.inputCs[i];
+            }
+        }
+
+        rolloutStep(ctx, ctx.inputCsPtrs);
+
+        trajectory[t].resize(numInputs);
+
+        for (int i = 0; i < numInputs; i++)
+            trajectory[t][i] = getPredictionCs(ctx, i);
+
+        if (values != nullptr) {
+            (*values)[t].resize(numInputs);
+
+            for (int i = 0; i < numInputs; i++) {
+                float value = 0.0f;
+
+                if (aLayers[i] != nullptr) {
+                    const FloatBuffer &hiddenValues = ctx.aHiddenValues[i];
+
+                    for (int j = 0; j < hiddenValues.size(); j++)
+                        value += hiddenValues[j];
+
+                    value /= hiddenValues.size();
+                }
+
+                (*values)[t][i] = value;
+            }
+        }
+    }
+}
+
+void Hierarchy::rollout(
+    ComputeSystem &cs,
+    int numSteps,
+    const std::vector<std::vector<const IntBuffer*>> &inputCs,
+    std::vector<std::vector<IntBuffer>> &trajectory,
+    RolloutArena &arena
+) const {
+    if (arena.contexts.empty())
+        arena.contexts.resize(1);
+
+    RolloutContext &ctx = arena.contexts.front();
+
+    // Copy, so the rollout's kernels and actor sampling do not advance cs.rng
+    ctx.cs = cs;
+
+    forkContext(ctx);
+
+    rolloutSteps(ctx, numSteps, inputCs, trajectory, nullptr);
+}
+
+void Hierarchy::evaluateCandidates(
+    ComputeSystem &cs,
+    int numSteps,
+    const std::vector<std::vector<std::vector<const IntBuffer*>>> &candidates,
+    std::vector<CandidateResult> &results,
+    RolloutArena &arena
+) const {
+    int numCandidates = candidates.size();
+
+    if (arena.contexts.size() < numCandidates)
+        arena.contexts.resize(numCandidates);
+
+    results.resize(numCandidates);
+
+    // Seeds are drawn up front from a copy, so cs.rng is not advanced and results do not depend on scheduling
+    std::mt19937 seedRng = cs.rng;
+
+    for (int c = 0; c < numCandidates; c++) {
+        RolloutContext &ctx = arena.contexts[c];
+
+        ctx.cs = cs;
+        ctx.cs.rng.seed(seedRng());
+
+        // Kernels of concurrent candidates would skew the shared tuner, profiler and recorders, so candidates skip them
+        ctx.cs.kernelTuner = nullptr;
+        ctx.cs.profiler = nullptr;
+        ctx.cs.traceRecorder = nullptr;
+        ctx.cs.stepLatencies = nullptr;
+    }
+
+    // Candidates only read the layers, kernels inside them run serially
+    #pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < numCandidates; c++) {
+        RolloutContext &ctx = arena.contexts[c];
+
+        forkContext(ctx);
+
+        rolloutSteps(ctx, numSteps, candidates[c], results[c].trajectory, &results[c].values);
+    }
+}
+
+// Copy a buffer into flat state at pos, returns the position after it
+static int writeStateBuffer(
+    const IntBuffer &buf,
+    IntBuffer &data,
+    int pos
+) {
+    std::copy(buf.begin(), buf.end(), data.begin() + pos);
+
+    return pos + buf.size();
+}
+
+// Copy a buffer out of flat state at pos, returns the position after it
+static int readStateBuffer(
+    IntBuffer &buf,
+    const IntBuffer &data,
+    int pos
+) {
+    std::copy(data.begin() + pos, data.begin() + pos + buf.size(), buf.begin());
+
+    return pos + buf.size();
+}
+
+MemoryUsage Hierarchy::memoryUsage() const {
+    MemoryUsage usage;
+
+    for (int l = 0; l < scLayers.size(); l++) {
+        usage += scLayers[l].memoryUsage();
+
+        for (int v = 0; v < pLayers[l].size(); v++) {
+            if (pLayers[l][v] != nullptr)
+                usage += pLayers[l][v]->memoryUsage();
+        }
+
+        for (int i = 0; i < histories[l].size(); i++) {
+            for (int t = 0; t < histories[l][i].data.size(); t++)
+                usage.histories += vectorMemory(histories[l][i].data[t]);
+        }
+    }
+
+    for (int v = 0; v < aLayers.size(); v++) {
+        if (aLayers[v] != nullptr)
+            usage += aLayers[v]->memoryUsage();
+    }
+
+    usage.other += vectorMemory(updates) + vectorMemory(ticks) + vectorMemory(ticksPerUpdate) + vectorMemory(inputSizes);
+
+    for (int l = 0; l < deferredPredictors.size(); l++) {
+        for (int v = 0; v < deferredPredictors[l].size(); v++) {
+            const DeferredPredictor &dp = deferredPredictors[l][v];
+
+            usage.other += vectorMemory(dp.hiddenActivations);
+
+            for (int vli = 0; vli < dp.inputCsPrev.size(); vli++)
+                usage.other += vectorMemory(dp.inputCsPrev[vli]);
+        }
+    }
+
+    for (int l = 0; l < pipelineFeedBackCs.size(); l++)
+        usage.other += vectorMemory(pipelineFeedBackCs[l]);
+
+    usage.other += vectorMemory(pipelineCS);
+
+    return usage;
+}
+
+MemoryUsage Hierarchy::estimateMemoryUsage(
+    const std::vector<Int3> &inputSizes,
+    const std::vector<InputType> &inputTypes,
+    const std::vector<LayerDesc> &layerDescs
+) {
+    MemoryUsage usage;
+
+    int numLayers = layerDescs.size();
+
+    // Same layer structure as initRandom
+    for (int l = 0; l < numLayers; l++) {
+        std::vector<SparseCoder::VisibleLayerDesc> scVisibleLayerDescs;
+
+        std::vector<Predictor::VisibleLayerDesc> pVisibleLayerDescs(l < numLayers - 1 ? 2 : 1);
+
+        for (int v = 0; v < pVisibleLayerDescs.size(); v++) {
+            pVisibleLayerDescs[v].size = layerDescs[l].hiddenSize;
+            pVisibleLayerDescs[v].radius = layerDescs[l].pRadius;
+        }
+
+        if (l == 0) {
+            std::vector<Actor::VisibleLayerDesc> aVisibleLayerDescs(pVisibleLayerDescs.size());
+
+            for (int v = 0; v < aVisibleLayerDescs.size(); v++) {
+                aVisibleLayerDescs[v].size = layerDescs[l].hiddenSize;
+                aVisibleLayerDescs[v].radius = layerDescs[l].aRadius;
+            }
+
+            for (int i = 0; i < inputSizes.size(); i++) {
+                for (int t = 0; t < layerDescs[l].temporalHorizon; t++) {
+                    SparseCoder::VisibleLayerDesc vld;
+                    vld.size = inputSizes[i];
+                    vld.radius = layerDescs[l].ffRadius;
+
+                    scVisibleLayerDescs.push_back(vld);
+                }
+
+                usage.histories += static_cast<long long>(inputSizes[i].x) * inputSizes[i].y * layerDescs[l].temporalHorizon * sizeof(int);
+
+                if (inputTypes[i] == InputType::prediction)
+                    usage += Predictor::estimateMemoryUsage(inputSizes[i], pVisibleLayerDescs);
+                else if (inputTypes[i] == InputType::action)
+                    usage += Actor::estimateMemoryUsage(inputSizes[i], layerDescs[l].historyCapacity, aVisibleLayerDescs, layerDescs[l].compressHistory);
+            }
+        }
+        else {
+            scVisibleLayerDescs.resize(layerDescs[l].temporalHorizon);
+
+            for (int t = 0; t < layerDescs[l].temporalHorizon; t++) {
+                scVisibleLayerDescs[t].size = layerDescs[l - 1].hiddenSize;
+                scVisibleLayerDescs[t].radius = layerDescs[l].ffRadius;
+            }
+
+            usage.histories += static_cast<long long>(layerDescs[l - 1].hiddenSize.x) * layerDescs[l - 1].hiddenSize.y * layerDescs[l].temporalHorizon * sizeof(int);
+
+            MemoryUsage pUsage = Predictor::estimateMemoryUsage(layerDescs[l - 1].hiddenSize, pVisibleLayerDescs);
+
+            for (int p = 0; p < layerDescs[l].ticksPerUpdate; p++)
+                usage += pUsage;
+        }
+
+        usage += SparseCoder::estimateMemoryUsage(layerDescs[l].hiddenSize, scVisibleLayerDescs);
+    }
+
+    usage.other += numLayers * (sizeof(char) + sizeof(int) * 2) + inputSizes.size() * sizeof(Int3);
+
+    return usage;
+}
+
+int Hierarchy::computeStateSize() const {
+    int size = 0;
+
+    for (int l = 0; l < scLayers.size(); l++) {
+        size += scLayers[l].hiddenCs.size() + scLayers[l].hiddenCsPrev.size();
+
+        for (int j = 0; j < pLayers[l].size(); j++) {
+            if (pLayers[l][j] != nullptr) {
+                size += pLayers[l][j]->hiddenCs.size();
+
+                for (int v = 0; v < pLayers[l][j]->getNumVisibleLayers(); v++)
+                    size += pLayers[l][j]->visibleLayers[v].inputCsPrev.size();
+            }
+        }
+
+        for (int i = 0; i < histories[l].size(); i++) {
+            size++; // Start
+
+            for (int t = 0; t < histories[l][i].size(); t++)
+                size += histories[l][i].data[t].size();
+        }
+
+        size += 2; // Tick and update
+    }
+
+    return size;
+}
+
+void Hierarchy::getState(
+    State &state
+) const {
+    state.data.resize(getStateSize());
+
+    int pos = 0;
+
+    for (int l = 0; l < scLayers.size(); l++) {
+        pos = writeStateBuffer(scLayers[l].hiddenCs, state.data, pos);
+        pos = writeStateBuffer(scLayers[l].hiddenCsPrev, state.data, pos);
 
         for (int j = 0; j < pLayers[l].size(); j++) {
             if (pLayers[l][j] != nullptr) {
-                pLayers[l][j]->hiddenCs = state.predHiddenCs[l][j];
+                pos = writeStateBuffer(pLayers[l][j]->hiddenCs, state.data, pos);
 
                 for (int v = 0; v < pLayers[l][j]->getNumVisibleLayers(); v++)
-                    pLayers[l][j]->visibleLayers[v].inputCsPrev = state.predInputCsPrev[l][j][v];
+                    pos = writeStateBuffer(pLayers[l][j]->visibleLayers[v].inputCsPrev, state.data, pos);
+            }
+        }
+
+        // Histories are stored in slot order along with their start
+        for (int i = 0; i < histories[l].size(); i++) {
+            state.data[pos++] = histories[l][i].start;
+
+            for (int t = 0; t < histories[l][i].size(); t++)
+                pos = writeStateBuffer(histories[l][i].data[t], state.data, pos);
+        }
+
+        state.data[pos++] = ticks[l];
+        state.data[pos++] = updates[l];
+    }
+
+    assert(pos == state.data.size());
+}
+
+void Hierarchy::setState(
+    const State &state
+) {
+    assert(state.data.size() == getStateSize());
+
+    int pos = 0;
+
+    for (int l = 0; l < scLayers.size(); l++) {
+        pos = readStateBuffer(scLayers[l].hiddenCs, state.data, pos);
+        pos = readStateBuffer(scLayers[l].hiddenCsPrev, state.data, pos);
+
+        for (int j = 0; j < pLayers[l].size(); j++) {
+            if (pLayers[l][j] != nullptr) {
+                pos = readStateBuffer(pLayers[l][j]->hiddenCs, state.data, pos);
+
+                for (int v = 0; v < pLayers[l][j]->getNumVisibleLayers(); v++)
+                    pos = readStateBuffer(pLayers[l][j]->visibleLayers[v].inputCsPrev, state.data, pos);
+            }
+        }
+
+        for (int i = 0; i < histories[l].size(); i++) {
+            histories[l][i].start = state.data[pos++];
+
+            for (int t = 0; t < histories[l][i].size(); t++)
+                pos = readStateBuffer(histories[l][i].data[t], state.data, pos);
+        }
+
+        ticks[l] = state.data[pos++];
+        updates[l] = state.data[pos++];
+    }
+
+    markHistoriesChanged();
+}
+
+void Hierarchy::getSectionDescs(
+    std::vector<SectionDesc> &descs
+) const {
+    descs.clear();
+
+    descs.push_back(SectionDesc(sectionHierarchy, -1, -1));
+
+    for (int l = 0; l < scLayers.size(); l++) {
+        descs.push_back(SectionDesc(sectionHistories, l, -1));
+        descs.push_back(SectionDesc(sectionSparseCoder, l, -1));
+
+        for (int v = 0; v < pLayers[l].size(); v++) {
+            if (pLayers[l][v] != nullptr)
+                descs.push_back(SectionDesc(sectionPredictor, l, v));
+        }
+    }
+
+    for (int v = 0; v < aLayers.size(); v++) {
+        if (aLayers[v] != nullptr)
+            descs.push_back(SectionDesc(sectionActor, 0, v));
+    }
+}
+
+void Hierarchy::writeSection(
+    const SectionDesc &desc,
+    SectionWriter &sw
+) const {
+    switch (desc.type) {
+    case sectionHierarchy: {
+        int numLayers = scLayers.size();
+        int numInputs = inputSizes.size();
+
+        sw.write(numLayers);
+        sw.write(numInputs);
+
+        for (int i = 0; i < numInputs; i++)
+            sw.writeInt3(inputSizes[i]);
+
+        sw.writeBuffer(updates);
+        sw.writeBuffer(ticks);
+        sw.writeBuffer(ticksPerUpdate);
+
+        // Existence of predictors and actors
+        for (int l = 0; l < numLayers; l++) {
+            sw.write(static_cast<int>(pLayers[l].size()));
+
+            for (int v = 0; v < pLayers[l].size(); v++)
+                sw.write(static_cast<char>(pLayers[l][v] != nullptr));
+        }
+
+        for (int v = 0; v < aLayers.size(); v++)
+            sw.write(static_cast<char>(aLayers[v] != nullptr));
+
+        break;
+    }
+    case sectionHistories: {
+        const std::vector<CircleBuffer<IntBuffer>> &layerHistories = histories[desc.layer];
+
+        sw.write(static_cast<int>(layerHistories.size()));
+
+        for (int i = 0; i < layerHistories.size(); i++) {
+            sw.write(layerHistories[i].size());
+            sw.write(layerHistories[i].start);
+
+            // Deltas only hold the entries pushed since the base (newest first)
+            int numWritten = layerHistories[i].size();
+
+            if (sw.delta) {
+                numWritten = std::min(historyPushes[desc.layer], layerHistories[i].size());
+
+                sw.write(numWritten);
             }
+
+            for (int t = 0; t < numWritten; t++)
+                sw.writeBuffer(layerHistories[i][t]);
+        }
+
+        break;
+    }
+    case sectionSparseCoder:
+        scLayers[desc.layer].writeToSection(sw);
+
+        break;
+    case sectionPredictor:
+        pLayers[desc.layer][desc.index]->writeToSection(sw);
+
+        break;
+    case sectionActor:
+        aLayers[desc.index]->writeToSection(sw);
+
+        break;
+    }
+}
+
+bool Hierarchy::readHierarchySection(
+    SectionReader &sr
+) {
+    // Each layer takes at least its update, tick and predictor counts, each input its size
+    int numLayers = sr.readCount(3 * sizeof(int));
+    int numInputs = sr.readCount(3 * sizeof(int));
+
+    if (sr.getFailed())
+        return false;
+
+    inputSizes.resize(numInputs);
+
+    for (int i = 0; i < numInputs; i++)
+        inputSizes[i] = sr.readSize();
+
+    sr.readBuffer(updates);
+    sr.readBuffer(ticks);
+    sr.readBuffer(ticksPerUpdate);
+
+    if (sr.getFailed() || updates.size() != numLayers || ticks.size() != numLayers || ticksPerUpdate.size() != numLayers)
+        return false;
+
+    // Deltas patch existing layers
+    if (sr.delta && (numLayers != scLayers.size() || numInputs != aLayers.size()))
+        return false;
+
+    scLayers.resize(numLayers);
+    pLayers.resize(numLayers);
+    histories.resize(numLayers);
+
+    markHistoriesChanged();
+
+    for (int l = 0; l < numLayers; l++) {
+        int numPredictors = sr.readCount(sizeof(char));
+
+        if (sr.getFailed())
+            return false;
+
+        if (sr.delta && numPredictors != pLayers[l].size())
+            return false;
+
+        pLayers[l].resize(numPredictors);
+
+        for (int v = 0; v < numPredictors; v++) {
+            bool exists = sr.read<char>();
+
+            if (sr.delta && exists != (pLayers[l][v] != nullptr))
+                return false;
+
+            if (!exists)
+                pLayers[l][v] = nullptr;
+            else if (pLayers[l][v] == nullptr)
+                pLayers[l][v] = std::make_unique<Predictor>();
+        }
+    }
+
+    aLayers.resize(numInputs);
+
+    for (int v = 0; v < numInputs; v++) {
+        bool exists = sr.read<char>();
+
+        if (sr.delta && exists != (aLayers[v] != nullptr))
+            return false;
+
+        if (!exists)
+            aLayers[v] = nullptr;
+        else if (aLayers[v] == nullptr)
+            aLayers[v] = std::make_unique<Actor>();
+    }
+
+    return !sr.getFailed();
+}
+
+void Hierarchy::getWeightMatrices(
+    std::vector<SparseMatrix*> &mats
+) {
+    mats.clear();
+
+    for (int l = 0; l < scLayers.size(); l++) {
+        scLayers[l].getWeightMatrices(mats);
+
+        for (int v = 0; v < pLayers[l].size(); v++) {
+            if (pLayers[l][v] != nullptr)
+                pLayers[l][v]->getWeightMatrices(mats);
         }
     }
 
-    histories = state.histories;
-    ticks = state.ticks;
-    updates = state.updates;
-}
\ No newline at end of file
+    for (int v = 0; v < aLayers.size(); v++) {
+        if (aLayers[v] != nullptr)
+            aLayers[v]->getWeightMatrices(mats);
+    }
+}
+
+bool Hierarchy::readSection(
+    const SectionDesc &desc,
+    SectionReader &sr
+) {
+    switch (desc.type) {
+    case sectionHistories: {
+        if (desc.layer < 0 || desc.layer >= histories.size())
+            return false;
+
+        std::vector<CircleBuffer<IntBuffer>> &layerHistories = histories[desc.layer];
+
+        // Each input takes at least its history size and start, each history entry its buffer count
+        int numInputs = sr.readCount(2 * sizeof(int));
+
+        if (sr.getFailed() || (sr.delta && numInputs != layerHistories.size()))
+            return false;
+
+        layerHistories.resize(numInputs);
+
+        for (int i = 0; i < numInputs; i++) {
+            int historySize = sr.delta ? sr.read<int>() : sr.readCount(sizeof(int));
+            int historyStart = sr.read<int>();
+
+            if (sr.getFailed() || historyStart < 0 || historyStart >= std::max(1, historySize))
+                return false;
+
+            int numRead = historySize;
+
+            if (sr.delta) {
+                numRead = sr.readCount(sizeof(int));
+
+                // Must patch a history of the same size, whose newest entry directly follows the new ones
+                if (sr.getFailed() || historySize != layerHistories[i].size() || numRead > historySize ||
+                    (numRead < historySize && (historyStart + numRead) % historySize != layerHistories[i].start))
+                    return false;
+            }
+            else
+                layerHistories[i].resize(historySize);
+
+            layerHistories[i].start = historyStart;
+
+            for (int t = 0; t < numRead; t++)
+                sr.readBuffer(layerHistories[i][t]);
+        }
+
+        break;
+    }
+    case sectionSparseCoder:
+        if (desc.layer < 0 || desc.layer >= scLayers.size())
+            return false;
+
+        scLayers[desc.layer].readFromSection(sr);
+
+        break;
+    case sectionPredictor:
+        if (desc.layer < 0 || desc.layer >= pLayers.size() || desc.index < 0 || desc.index >= pLayers[desc.layer].size() || pLayers[desc.layer][desc.index] == nullptr)
+            return false;
+
+        pLayers[desc.layer][desc.index]->readFromSection(sr);
+
+        break;
+    case sectionActor:
+        if (desc.index < 0 || desc.index >= aLayers.size() || aLayers[desc.index] == nullptr)
+            return false;
+
+        aLayers[desc.index]->readFromSection(sr);
+
+        break;
+    default: // Unknown sections are skipped
+        break;
+    }
+
+    return !sr.getFailed();
+}
+
+void Hierarchy::writeToModel(
+    std::ostream &os,
+    bool compact
+) const {
+    std::vector<SectionDesc> descs;
+
+    getSectionDescs(descs);
+
+    std::vector<SectionWriter> sections(descs.size());
+
+    // Sections are independent, encode them in parallel (sizes vary a lot, so schedule dynamically)
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < descs.size(); i++) {
+        sections[i].compact = compact;
+
+        writeSection(descs[i], sections[i]);
+    }
+
+    writeModelToStream(os, descs, sections, compact ? modelFlagCompact : 0);
+}
+
+bool Hierarchy::readFromModel(
+    const ModelFileReader &reader
+) {
+    int hierarchyIndex = reader.findSection(sectionHierarchy, -1, -1);
+
+    if (hierarchyIndex == -1)
+        return false;
+
+    SectionReader hr = reader.getSectionReader(hierarchyIndex);
+
+    if (!readHierarchySection(hr))
+        return false;
+
+    // Every allocated layer must be present
+    std::vector<SectionDesc> descs;
+
+    getSectionDescs(descs);
+
+    std::vector<int> sectionIndices;
+
+    for (int i = 0; i < descs.size(); i++) {
+        if (descs[i].type == sectionHierarchy)
+            continue;
+
+        int sectionIndex = reader.findSection(descs[i].type, descs[i].layer, descs[i].index);
+
+        if (sectionIndex == -1)
+            return false;
+
+        sectionIndices.push_back(sectionIndex);
+    }
+
+    // Each section decodes into its own layer, so they can be read in parallel
+    bool succeeded = true;
+
+    #pragma omp parallel for schedule(dynamic) reduction(&&:succeeded)
+    for (int i = 0; i < sectionIndices.size(); i++) {
+        SectionReader sr = reader.getSectionReader(sectionIndices[i]);
+
+        succeeded = readSection(reader.getSection(sectionIndices[i]), sr) && succeeded;
+    }
+
+    stateSize = computeStateSize();
+
+    return succeeded;
+}
+
+bool Hierarchy::writeToFile(
+    const std::string &fileName,
+    bool compact
+) const {
+    std::ofstream os(fileName, std::ios::binary);
+
+    if (!os.is_open())
+        return false;
+
+    writeToModel(os, compact);
+
+    return os.good();
+}
+
+bool Hierarchy::readFromFile(
+    const std::string &fileName,
+    TopologyCache* topologyCache
+) {
+    ModelFileReader reader;
+
+    reader.topologyCache = topologyCache;
+
+    if (!reader.open(fileName))
+        return false;
+
+    return readFromModel(reader);
+}
+
+bool Hierarchy::readFromFiles(
+    const std::string &baseFileName,
+    const std::vector<std::string> &deltaFileNames,
+    TopologyCache* topologyCache
+) {
+    ModelFileReader reader;
+
+    reader.topologyCache = topologyCache;
+
+    if (!reader.open(baseFileName) || (reader.getFlags() & modelFlagDelta) != 0 || !readFromModel(reader))
+        return false;
+
+    for (int i = 0; i < deltaFileNames.size(); i++) {
+        if (!reader.open(deltaFileNames[i]) || (reader.getFlags() & modelFlagDelta) == 0 || !readFromModel(reader))
+            return false;
+    }
+
+    return true;
+}
+
+void Hierarchy::setDirtyTracking(
+    bool enabled,
+    int blockSize
+) {
+    std::vector<SparseMatrix*> mats;
+
+    getWeightMatrices(mats);
+
+    for (int i = 0; i < mats.size(); i++) {
+        if (enabled)
+            mats[i]->initDirty(blockSize);
+        else
+            mats[i]->clearDirty();
+    }
+
+    if (enabled)
+        resetDirty();
+    else {
+        markHistoriesChanged();
+
+        for (int v = 0; v < aLayers.size(); v++) {
+            if (aLayers[v] != nullptr)
+                aLayers[v]->markHistoryChanged();
+        }
+    }
+}
+
+void Hierarchy::markHistoriesChanged() {
+    historyPushes.assign(scLayers.size(), std::numeric_limits<int>::max());
+}
+
+void Hierarchy::resetDirty() {
+    std::vector<SparseMatrix*> mats;
+
+    getWeightMatrices(mats);
+
+    for (int i = 0; i < mats.size(); i++)
+        mats[i]->resetDirty();
+
+    historyPushes.assign(scLayers.size(), 0);
+
+    for (int v = 0; v < aLayers.size(); v++) {
+        if (aLayers[v] != nullptr)
+            aLayers[v]->resetHistoryPushes();
+    }
+}
+
+void Hierarchy::writeDeltaToModel(
+    std::ostream &os
+) const {
+    std::vector<SectionDesc> descs;
+
+    getSectionDescs(descs);
+
+    std::vector<SectionWriter> sections(descs.size());
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < descs.size(); i++) {
+        sections[i].delta = true;
+
+        writeSection(descs[i], sections[i]);
+    }
+
+    writeModelToStream(os, descs, sections, modelFlagDelta);
+}
+
+bool Hierarchy::writeDeltaToFile(
+    const std::string &fileName
+) {
+    std::ofstream os(fileName, std::ios::binary);
+
+    if (!os.is_open())
+        return false;
+
+    writeDeltaToModel(os);
+
+    os.close();
+
+    if (!os.good())
+        return false;
+
+    resetDirty();
+
+    return true;
+}
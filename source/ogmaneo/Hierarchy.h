@@ -13,6 +13,7 @@
 #include "Actor.h"
 
 #include <memory>
+#include <chrono>
 
 namespace ogmaneo {
 // Type of hierarchy input layer
@@ -22,17 +23,64 @@ enum InputType {
     action = 2
 };
 
-// State of hierarchy
+// State of hierarchy (everything that changes per step except weights), flattened into one contiguous buffer
+// so it can be copied with a single memcpy and pooled. Reusing a State does not allocate
 struct State {
-    std::vector<IntBuffer> hiddenCs;
-    std::vector<IntBuffer> hiddenCsPrev;
-    std::vector<std::vector<std::vector<IntBuffer>>> predInputCsPrev;
-    std::vector<std::vector<IntBuffer>> predHiddenCs;
+    IntBuffer data; // Layout is determined by the hierarchy structure, see Hierarchy::getStateSize
+};
+
+// Everything a rollout changes per step. Rollouts only read the hierarchy (weights), so several can run at once, each in its own context
+struct RolloutContext {
+    ComputeSystem cs; // Own RNG
 
     std::vector<std::vector<CircleBuffer<IntBuffer>>> histories;
 
     std::vector<char> updates;
     std::vector<int> ticks;
+
+    std::vector<IntBuffer> scHiddenCs; // [layer]
+
+    std::vector<std::vector<IntBuffer>> pHiddenCs; // [layer][predictor]
+    std::vector<std::vector<FloatBuffer>> pHiddenActivations;
+
+    std::vector<IntBuffer> aHiddenCs; // [input]
+    std::vector<FloatBuffer> aHiddenValues;
+    std::vector<FloatBuffer> aHiddenActivations;
+
+    // Inputs of the current rollout step
+    std::vector<IntBuffer> inputCs;
+    std::vector<const IntBuffer*> inputCsPtrs;
+};
+
+// Scratch memory for Hierarchy::rollout, reuse between calls to avoid allocation
+struct RolloutArena {
+    std::vector<RolloutContext> contexts; // One per candidate
+};
+
+// Outcome of one candidate of Hierarchy::evaluateCandidates
+struct CandidateResult {
+    std::vector<std::vector<IntBuffer>> trajectory; // Predictions of all inputs after each step, [step][input]
+    std::vector<FloatBuffer> values; // Mean actor value after each step, [step][input] (0 for inputs without an actor)
+};
+
+// Learning work done and dropped by Hierarchy::stepBudgeted
+struct BudgetStats {
+    long long scLearned; // Sparse coder updates
+    long long scSkipped;
+    long long pLearned; // Predictor updates
+    long long pSkipped;
+    long long aItersLearned; // Actor replay iterations
+    long long aItersSkipped;
+
+    BudgetStats()
+    :
+    scLearned(0),
+    scSkipped(0),
+    pLearned(0),
+    pSkipped(0),
+    aItersLearned(0),
+    aItersSkipped(0)
+    {}
 };
 
 // A SPH
@@ -52,6 +100,7 @@ public:
         // If there is an actor (only valid for first layer)
         int aRadius;
         int historyCapacity;
+        bool compressHistory; // Delta encode actor history to reduce memory
 
         LayerDesc()
         :
@@ -61,7 +110,8 @@ public:
         ticksPerUpdate(2),
         temporalHorizon(4),
         aRadius(2),
-        historyCapacity(32)
+        historyCapacity(32),
+        compressHistory(false)
         {}
     };
 private:
@@ -82,14 +132,148 @@ private:
     // Input dimensions
     std::vector<Int3> inputSizes;
 
+    // Per layer, history entries pushed since resetDirty (saturates), delta sections only hold these
+    std::vector<int> historyPushes;
+
+    void countHistoryPush(
+        int l
+    ) {
+        if (historyPushes[l] < std::numeric_limits<int>::max())
+            historyPushes[l]++;
+    }
+
+    // Treat all histories as changed (delta sections hold all of them)
+    void markHistoriesChanged();
+
+    int stateSize; // Number of elements of State::data, fixed by the structure
+
+    // Walk the layers to find the state size, stored in stateSize on init and load
+    int computeStateSize() const;
+
+    // --- Model File Sections ---
+
+    // List the sections this hierarchy is stored as
+    void getSectionDescs(
+        std::vector<SectionDesc> &descs
+    ) const;
+
+    void writeSection(
+        const SectionDesc &desc,
+        SectionWriter &sw
+    ) const;
+
+    // Read a non-hierarchy section, layers must already be allocated by the hierarchy section
+    bool readSection(
+        const SectionDesc &desc,
+        SectionReader &sr
+    );
+
+    enum StepMode {
+        modeNormal,
+        modeDeferred // Learning is left to learnDeferred
+    };
+
+    // Predictor state kept by a deferred step for learning
+    struct DeferredPredictor {
+        FloatBuffer hiddenActivations;
+        std::vector<IntBuffer> inputCsPrev;
+    };
+
+    std::vector<std::vector<DeferredPredictor>> deferredPredictors;
+
+    bool learnPending; // Whether learnDeferred has work
+    bool deferredMimic;
+
+    BudgetStats budgetStats;
+
+    // Scratch for stepPipelined
+    std::vector<IntBuffer> pipelineFeedBackCs;
+    std::vector<int> pipelineLayers; // Layers updated in the current step
+    std::vector<ComputeSystem> pipelineCS; // Per layer, keeps its own RNG across steps
+
+    // Deferred step without latency recording of the whole call
+    void beginDeferred(
+        ComputeSystem &cs,
+        const std::vector<const IntBuffer*> &inputCs,
+        float reward,
+        bool mimic
+    );
+
+    // Deferred learning, stops starting new work once past the deadline (if not null)
+    void learnDeferred(
+        ComputeSystem &cs,
+        const std::chrono::steady_clock::time_point* deadline
+    );
+
+    // Step implementation
+    void step(
+        ComputeSystem &cs,
+        const std::vector<const IntBuffer*> &inputCs,
+        bool learnEnabled,
+        float reward,
+        bool mimic,
+        StepMode mode
+    );
+
+    // Copy the current per-step state into a rollout context (reusing its buffers)
+    void forkContext(
+        RolloutContext &ctx
+    ) const;
+
+    // Prediction of input i in a rollout context, as getPredictionCs
+    const IntBuffer &getPredictionCs(
+        const RolloutContext &ctx,
+        int i
+    ) const {
+        if (aLayers[i] != nullptr)
+            return ctx.aHiddenCs[i];
+
+        return ctx.pHiddenCs.front()[i];
+    }
+
+    // One learning-free step in a rollout context, only reads the layers
+    void rolloutStep(
+        RolloutContext &ctx,
+        const std::vector<const IntBuffer*> &inputCs
+    ) const;
+
+    // Learning-free steps in a rollout context, starting from its current state
+    void rolloutSteps(
+        RolloutContext &ctx,
+        int numSteps,
+        const std::vector<std::vector<const IntBuffer*>> &inputCs,
+        std::vector<std::vector<IntBuffer>> &trajectory,
+        std::vector<FloatBuffer>* values
+    ) const;
+
+    // Read the hierarchy section and allocate layers (delta sections must match the existing layers)
+    bool readHierarchySection(
+        SectionReader &sr
+    );
+
+    // Gather the weight matrices of all layers
+    void getWeightMatrices(
+        std::vector<SparseMatrix*> &mats
+    );
+
 public:
     // Default
-    Hierarchy() {}
+    Hierarchy()
+    :
+    stateSize(0),
+    learnPending(false),
+    deferredMimic(false)
+    {}
 
     // Copy
     Hierarchy(
         const Hierarchy &other // Hierarchy to copy from
-    ) {
+    )
+    :
+    stateSize(0),
+    learnPending(false),
+    deferredMimic(false)
+    {
         *this = other;
     }
 
@@ -115,12 +299,106 @@ public:
         bool mimic = false // Use to train action inputs to act as predictors (mimic learning)
     );
 
-    // State get
+    // Step with all layers running concurrently (one thread per layer, each layer's kernels run serially unless nested parallelism is enabled).
+    // Layer l + 1 processes what layer l produced in the previous step while layer l processes the current one:
+    // - latency: input reaches layer l after l steps (plus its usual ticksPerUpdate wait)
+    // - staleness: feed back to layer l is the prediction of layer l + 1 from the previous step
+    // Can be mixed with step, histories and ticks stay consistent. Predictions of the first layer are available when this returns
+    // The updated layers split the threads between them, each layer's kernels run on its share (nested parallelism)
+    void stepPipelined(
+        ComputeSystem &cs, // Compute system
+        const std::vector<const IntBuffer*> &inputCs, // Inputs to remember
+        bool learnEnabled = true, // Whether learning is enabled
+        float reward = 0.0f, // Optional reward for actor layers
+        bool mimic = false // Use to train action inputs to act as predictors (mimic learning)
+    );
+
+    // Step without learning, keeping what is needed to learn this step later with learnDeferred.
+    // Predictions and actions are available as soon as this returns. Consistency: learning of step t is applied before
+    // inference of step t + 1 (the next step calls learnDeferred first if it was not called in between), except that
+    // predictor activations of step t do not yet include the update towards the inputs of step t (one step stale,
+    // a normal step learns before activating)
+    void stepDeferred(
+        ComputeSystem &cs, // Compute system
+        const std::vector<const IntBuffer*> &inputCs, // Inputs to remember
+        float reward = 0.0f, // Optional reward for actor layers
+        bool mimic = false // Use to train action inputs to act as predictors (mimic learning)
+    );
+
+    // Apply the learning of the last stepDeferred, may run on another thread as long as nothing else uses this hierarchy
+    // (or cs) meanwhile, except for reading predictions. Does nothing if no learning is pending
+    void learnDeferred(
+        ComputeSystem &cs // Compute system
+    );
+
+    // Step within a time budget: inference always completes, then learning runs in the usual order
+    // (sparse coders, predictors, actor replay iterations) while budget remains. The rest is dropped and counted in getBudgetStats.
+    // Budget is checked between units of work, so a step may overrun by at most one unit
+    void stepBudgeted(
+        ComputeSystem &cs, // Compute system
+        const std::vector<const IntBuffer*> &inputCs, // Inputs to remember
+        float budget, // Time budget in seconds, counted from the call
+        float reward = 0.0f, // Optional reward for actor layers
+        bool mimic = false // Use to train action inputs to act as predictors (mimic learning)
+    );
+
+    // Learning done and dropped so far (counted by deferred learning)
+    const BudgetStats &getBudgetStats() const {
+        return budgetStats;
+    }
+
+    void resetBudgetStats() {
+        budgetStats = BudgetStats();
+    }
+
+    // Whether a deferred step still has to learn
+    bool isLearnPending() const {
+        return learnPending;
+    }
+
+    // Roll forward from the current state without learning, feeding predictions back as inputs.
+    // Inputs can be overridden per step, e.g. to try hypothetical actions. The hierarchy is not changed:
+    // the rollout steps a copy of the per-step state, with a copy of cs (so its RNG is not advanced)
+    void rollout(
+        ComputeSystem &cs, // Compute system
+        int numSteps, // Number of steps to roll forward
+        const std::vector<std::vector<const IntBuffer*>> &inputCs, // Per step and input, input to use instead of the prediction, nullptr (or missing steps) to use the prediction
+        std::vector<std::vector<IntBuffer>> &trajectory, // Resulting predictions of all inputs after each step, [step][input]
+        RolloutArena &arena // Scratch memory
+    ) const;
+
+    // Evaluate candidate input (e.g. action) sequences from the current state, as a rollout per candidate.
+    // Candidates run in parallel, each in its own context (state copy and RNG) reading the shared weights.
+    // Results do not depend on the number of threads, and cs.rng is not advanced
+    void evaluateCandidates(
+        ComputeSystem &cs, // Compute system
+        int numSteps, // Number of steps to roll forward
+        const std::vector<std::vector<std::vector<const IntBuffer*>>> &candidates, // Per candidate, inputs as in rollout, [candidate][step][input]
+        std::vector<CandidateResult> &results, // Result per candidate, reuse to avoid allocation
+        RolloutArena &arena // Scratch memory
+    ) const;
+
+    // Number of elements of State::data for this hierarchy
+    int getStateSize() const {
+        return stateSize;
+    }
+
+    // Memory held by all layers, histories and step scratch
+    MemoryUsage memoryUsage() const;
+
+    // Memory initRandom will allocate for these arguments, without allocating it
+    static MemoryUsage estimateMemoryUsage(
+        const std::vector<Int3> &inputSizes, // Sizes of input layers
+        const std::vector<InputType> &inputTypes, // Types of input layers (same size as inputSizes)
+        const std::vector<LayerDesc> &layerDescs // Descriptors for layers
+    );
+
+    // State get, in place (only allocates if state is smaller than needed)
     void getState(
         State &state
     ) const;
 
-    // State set
+    // State set, in place. State must come from a hierarchy with the same structure
     void setState(
         const State &state
     );
@@ -132,7 +410,61 @@ public:
 
     // Read from stream
     void readFromStream(
-        std::istream &is // Stream to read from
+        std::istream &is, // Stream to read from
+        TopologyCache* topologyCache = nullptr // Optional cache to take weight topologies from instead of the stream
+    );
+
+    // Write in the versioned model file format
+    void writeToModel(
+        std::ostream &os, // Stream to write to
+        bool compact = false // Omit topology (regenerated on load), stores weight values only
+    ) const;
+
+    // Read from an opened model file, returns false if the model is invalid
+    bool readFromModel(
+        const ModelFileReader &reader // Opened model file
+    );
+
+    // Write a model file
+    bool writeToFile(
+        const std::string &fileName, // Name of file to write
+        bool compact = false // Omit topology (regenerated on load), stores weight values only
+    ) const;
+
+    // Read a model file (memory mapped where supported), returns false on failure.
+    // Delta files are applied on top of the current hierarchy
+    bool readFromFile(
+        const std::string &fileName, // Name of file to read
+        TopologyCache* topologyCache = nullptr // Optional cache to take weight topologies from instead of the file
+    );
+
+    // Read a base model file and then apply delta files in order, returns false on failure
+    bool readFromFiles(
+        const std::string &baseFileName, // Name of the full model file
+        const std::vector<std::string> &deltaFileNames, // Names of delta files, oldest first
+        TopologyCache* topologyCache = nullptr // Optional cache to take weight topologies from instead of the file
+    );
+
+    // --- Differential Checkpoints ---
+
+    // Enable/disable tracking of changed weights and histories. Enabling marks everything clean
+    void setDirtyTracking(
+        bool enabled, // Whether to track
+        int blockSize = 1024 // Number of weights per tracked block (rounded up to a power of 2)
+    );
+
+    // Mark all weights and histories clean
+    void resetDirty();
+
+    // Write a delta model file containing the weight blocks changed and history entries pushed since the last reset,
+    // plus the remaining (per step) state. Weights of untracked matrices and histories are written in full
+    void writeDeltaToModel(
+        std::ostream &os // Stream to write to
+    ) const;
+
+    // Write a delta model file and mark all weights clean on success
+    bool writeDeltaToFile(
+        const std::string &fileName // Name of file to write
     );
 
     // Get the number of layers (scLayers)
@@ -108,8 +108,6 @@ void ImageEncoder::initRandom(
     int numHiddenColumns = hiddenSize.x * hiddenSize.y;
     int numHidden = numHiddenColumns * hiddenSize.z;
 
-    std::uniform_real_distribution<float> weightDist(0.0f, 1.0f);
-
     // Create layers
     for (int vli = 0; vli < visibleLayers.size(); vli++) {
         VisibleLayer &vl = visibleLayers[vli];
@@ -119,13 +117,10 @@ void ImageEncoder::initRandom(
         int numVisible = numVisibleColumns * vld.size.z;
 
         // Create weight matrix for this visible layer and initialize randomly
-        initSMLocalRF(vld.size, hiddenSize, vld.radius, vl.weights);
-
-        for (int i = 0; i < vl.weights.nonZeroValues.size(); i++)
-            vl.weights.nonZeroValues[i] = weightDist(cs.rng);
+        // Transpose is needed for reconstruction
+        initSMLocalRF(cs, vld.size, hiddenSize, vld.radius, true, vl.weights);
 
-        // Generate transpose (needed for reconstruction)
-        vl.weights.initT();
+        initSMUniform(cs.rng, 0.0f, 1.0f, vl.weights);
 
         vl.reconstructions = FloatBuffer(numVisible, 0.0f);
     }
@@ -144,7 +139,12 @@ void ImageEncoder::step(
     int numHiddenColumns = hiddenSize.x * hiddenSize.y;
     int numHidden = numHiddenColumns * hiddenSize.z;
 
-    runKernel2(cs, std::bind(ImageEncoder::forwardKernel, std::placeholders::_1, std::placeholders::_2, this, inputActs, learnEnabled), Int2(hiddenSize.x, hiddenSize.y), cs.rng, cs.batchSize2);
+    int numWeights = 0;
+
+    for (int vli = 0; vli < visibleLayers.size(); vli++)
+        numWeights += visibleLayers[vli].weights.nonZeroValues.size();
+
+    runKernel2(cs, std::bind(ImageEncoder::forwardKernel, std::placeholders::_1, std::placeholders::_2, this, inputActs, learnEnabled), Int2(hiddenSize.x, hiddenSize.y), cs.rng, cs.batchSize2, numWeights / numHiddenColumns);
 }
 
 void ImageEncoder::reconstruct(
@@ -155,7 +155,9 @@ void ImageEncoder::reconstruct(
         VisibleLayer &vl = visibleLayers[vli];
         VisibleLayerDesc &vld = visibleLayerDescs[vli];
 
-        runKernel2(cs, std::bind(ImageEncoder::backwardKernel, std::placeholders::_1, std::placeholders::_2, this, hiddenCs, vli), Int2(vld.size.x, vld.size.y), cs.rng, cs.batchSize2);
+        int numVisibleColumns = vld.size.x * vld.size.y;
+
+        runKernel2(cs, std::bind(ImageEncoder::backwardKernel, std::placeholders::_1, std::placeholders::_2, this, hiddenCs, vli), Int2(vld.size.x, vld.size.y), cs.rng, cs.batchSize2, vl.weights.nonZeroValues.size() / numVisibleColumns);
     }
 }
 
@@ -223,4 +225,41 @@ void ImageEncoder::readFromStream(
 
         readBufferFromStream(is, &vl.reconstructions);
     }
-}
\ No newline at end of file
+}
+
+MemoryUsage ImageEncoder::memoryUsage() const {
+    MemoryUsage usage;
+
+    for (int vli = 0; vli < visibleLayers.size(); vli++) {
+        const VisibleLayer &vl = visibleLayers[vli];
+
+        usage += vl.weights.memoryUsage();
+
+        usage.states += vectorMemory(vl.reconstructions);
+    }
+
+    usage.states += vectorMemory(hiddenCs) + vectorMemory(hiddenResources);
+
+    return usage;
+}
+
+MemoryUsage ImageEncoder::estimateMemoryUsage(
+    const Int3 &hiddenSize,
+    const std::vector<VisibleLayerDesc> &visibleLayerDescs
+) {
+    MemoryUsage usage;
+
+    for (int vli = 0; vli < visibleLayerDescs.size(); vli++) {
+        const VisibleLayerDesc &vld = visibleLayerDescs[vli];
+
+        usage += estimateSMLocalRF(vld.size, hiddenSize, vld.radius, true);
+
+        usage.states += static_cast<long long>(vld.size.x) * vld.size.y * vld.size.z * sizeof(float);
+    }
+
+    long long numHiddenColumns = static_cast<long long>(hiddenSize.x) * hiddenSize.y;
+
+    usage.states += numHiddenColumns * sizeof(int) + numHiddenColumns * hiddenSize.z * sizeof(float);
+
+    return usage;
+}
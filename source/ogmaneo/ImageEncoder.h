@@ -141,6 +141,15 @@ public:
         return visibleLayerDescs[i];
     }
 
+    // Memory held by weights and states
+    MemoryUsage memoryUsage() const;
+
+    // Memory initRandom will allocate for these arguments
+    static MemoryUsage estimateMemoryUsage(
+        const Int3 &hiddenSize, // Hidden/output size
+        const std::vector<VisibleLayerDesc> &visibleLayerDescs // Descriptors for visible layers
+    );
+
     // Get the hidden states
     const IntBuffer &getHiddenCs() const {
         return hiddenCs;
@@ -0,0 +1,279 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#include "KernelTuner.h"
+
+#include "ComputeSystem.h"
+
+#include <algorithm>
+
+using namespace ogmaneo;
+
+static KernelTuner::Key shapeKey(
+    const KernelShape &shape
+) {
+    return KernelTuner::Key{ shape.kernelClass, shape.size.x, shape.size.y, shape.size.z, shape.radius };
+}
+
+static KernelShape keyShape(
+    const KernelTuner::Key &key,
+    int weightsPerColumn
+) {
+    return KernelShape(static_cast<KernelClass>(key[0]), Int3(key[1], key[2], key[3]), key[4], weightsPerColumn);
+}
+
+// Largest batch whose working set fits the cache while leaving a few batches per thread
+static Int2 guessBatchSize(
+    const KernelShape &shape,
+    int cacheBytes
+) {
+    int numThreads = omp_get_max_threads();
+
+    // Weights are stored as value and column index
+    long long bytesPerColumn = std::max(1, shape.weightsPerColumn) * static_cast<long long>(sizeof(float) + sizeof(int));
+
+    if (shape.kernelClass == kernelCopy) {
+        int maxBatch = numThreads > 1 ? (shape.size.x + numThreads * 2 - 1) / (numThreads * 2) : shape.size.x;
+
+        int batch = 64;
+
+        while (batch * 2 <= maxBatch && batch * 2 * bytesPerColumn <= cacheBytes)
+            batch *= 2;
+
+        return Int2(std::max(1, std::min(batch, shape.size.x)), 1);
+    }
+
+    int numColumns = shape.size.x * shape.size.y;
+
+    int minBatches = numThreads > 1 ? numThreads * 2 : 1;
+
+    int side = 1;
+
+    while (side < 64) {
+        int next = side * 2;
+
+        // Neighbouring receptive fields overlap, so inputs grow with the tile border only
+        int inputSide = next + shape.radius * 2;
+
+        long long bytes = next * next * bytesPerColumn + inputSide * inputSide * static_cast<long long>(sizeof(int));
+
+        if (bytes > cacheBytes || next * next * minBatches > numColumns)
+            break;
+
+        side = next;
+    }
+
+    return Int2(std::min(side, shape.size.x), std::min(side, shape.size.y));
+}
+
+KernelTuner::KernelTuner()
+:
+trialsPerCandidate(3),
+cacheBytes(256 * 1024),
+tuning(true)
+{
+    candidates2 = { Int2(1, 1), Int2(2, 2), Int2(4, 4), Int2(8, 8), Int2(1, 8), Int2(8, 1), Int2(16, 16) };
+    candidates1 = { 64, 256, 512, 2048, 8192 };
+}
+
+void KernelTuner::initEntry(
+    const KernelShape &shape,
+    Entry &entry
+) const {
+    entry.best = guessBatchSize(shape, cacheBytes);
+
+    entry.candidates.clear();
+    entry.candidates.push_back(entry.best);
+
+    if (tuning) {
+        if (shape.kernelClass == kernelCopy) {
+            for (int i = 0; i < candidates1.size(); i++) {
+                Int2 c(std::min(candidates1[i], shape.size.x), 1);
+
+                if (std::find_if(entry.candidates.begin(), entry.candidates.end(), [&](const Int2 &o) { return o.x == c.x; }) == entry.candidates.end())
+                    entry.candidates.push_back(c);
+            }
+        }
+        else {
+            for (int i = 0; i < candidates2.size(); i++) {
+                Int2 c(std::min(candidates2[i].x, shape.size.x), std::min(candidates2[i].y, shape.size.y));
+
+                if (std::find_if(entry.candidates.begin(), entry.candidates.end(), [&](const Int2 &o) { return o.x == c.x && o.y == c.y; }) == entry.candidates.end())
+                    entry.candidates.push_back(c);
+            }
+        }
+    }
+
+    entry.times = std::vector<double>(entry.candidates.size(), 0.0);
+    entry.counts = std::vector<int>(entry.candidates.size(), 0);
+
+    entry.trial = entry.candidates.size() > 1 ? 0 : -1;
+}
+
+KernelTuner::Entry &KernelTuner::getEntry(
+    const KernelShape &shape
+) {
+    std::map<Key, Entry>::iterator it = entries.find(shapeKey(shape));
+
+    if (it == entries.end()) {
+        it = entries.insert(std::make_pair(shapeKey(shape), Entry())).first;
+
+        it->second.weightsPerColumn = shape.weightsPerColumn;
+
+        initEntry(shape, it->second);
+    }
+
+    return it->second;
+}
+
+int KernelTuner::beginLaunch(
+    const KernelShape &shape,
+    Int2 &batchSize
+) {
+    int trial = -1;
+
+    // Layers may launch kernels concurrently (pipelined steps)
+    #pragma omp critical (ogmaneoKernelTuner)
+    {
+        Entry &entry = getEntry(shape);
+
+        int numCandidates = entry.candidates.size();
+
+        if (entry.trial >= 0 && entry.trial < numCandidates * (trialsPerCandidate + 1)) {
+            trial = entry.trial;
+
+            entry.trial++;
+
+            batchSize = entry.candidates[trial % numCandidates];
+        }
+        else
+            batchSize = entry.best;
+    }
+
+    return trial;
+}
+
+void KernelTuner::endLaunch(
+    const KernelShape &shape,
+    int trial,
+    double seconds
+) {
+    if (trial < 0)
+        return;
+
+    #pragma omp critical (ogmaneoKernelTuner)
+    {
+        Entry &entry = getEntry(shape);
+
+        int numCandidates = entry.candidates.size();
+
+        // First round warms caches and is not counted. Ignore reports from before a retune
+        if (entry.trial >= 0 && trial >= numCandidates && trial < numCandidates * (trialsPerCandidate + 1)) {
+            int c = trial % numCandidates;
+
+            entry.times[c] += seconds;
+            entry.counts[c]++;
+
+            int total = 0;
+
+            for (int i = 0; i < numCandidates; i++)
+                total += entry.counts[i];
+
+            if (total == numCandidates * trialsPerCandidate) {
+                int bestIndex = 0;
+
+                for (int i = 1; i < numCandidates; i++) {
+                    if (entry.times[i] < entry.times[bestIndex])
+                        bestIndex = i;
+                }
+
+                entry.best = entry.candidates[bestIndex];
+                entry.trial = -1;
+            }
+        }
+    }
+}
+
+void KernelTuner::retune() {
+    for (std::map<Key, Entry>::iterator it = entries.begin(); it != entries.end(); it++)
+        initEntry(keyShape(it->first, it->second.weightsPerColumn), it->second);
+}
+
+bool KernelTuner::isTuning() const {
+    for (std::map<Key, Entry>::const_iterator it = entries.begin(); it != entries.end(); it++) {
+        if (it->second.trial >= 0)
+            return true;
+    }
+
+    return false;
+}
+
+Int2 KernelTuner::getBatchSize(
+    const KernelShape &shape
+) const {
+    std::map<Key, Entry>::const_iterator it = entries.find(shapeKey(shape));
+
+    if (it == entries.end())
+        return guessBatchSize(shape, cacheBytes);
+
+    return it->second.best;
+}
+
+void KernelTuner::writeToStream(
+    std::ostream &os
+) const {
+    int numThreads = omp_get_max_threads();
+    int numEntries = entries.size();
+
+    os.write(reinterpret_cast<const char*>(&numThreads), sizeof(int));
+    os.write(reinterpret_cast<const char*>(&numEntries), sizeof(int));
+
+    for (std::map<Key, Entry>::const_iterator it = entries.begin(); it != entries.end(); it++) {
+        os.write(reinterpret_cast<const char*>(it->first.data()), it->first.size() * sizeof(int));
+
+        os.write(reinterpret_cast<const char*>(&it->second.weightsPerColumn), sizeof(int));
+        os.write(reinterpret_cast<const char*>(&it->second.best), sizeof(Int2));
+    }
+}
+
+void KernelTuner::readFromStream(
+    std::istream &is
+) {
+    int numThreads;
+    int numEntries;
+
+    is.read(reinterpret_cast<char*>(&numThreads), sizeof(int));
+    is.read(reinterpret_cast<char*>(&numEntries), sizeof(int));
+
+    // Best batch sizes depend on the number of threads sharing the columns
+    bool matching = numThreads == omp_get_max_threads();
+
+    for (int i = 0; i < numEntries; i++) {
+        Key key;
+        int weightsPerColumn;
+        Int2 best;
+
+        is.read(reinterpret_cast<char*>(key.data()), key.size() * sizeof(int));
+        is.read(reinterpret_cast<char*>(&weightsPerColumn), sizeof(int));
+        is.read(reinterpret_cast<char*>(&best), sizeof(Int2));
+
+        if (!matching)
+            continue;
+
+        Entry &entry = entries[key];
+
+        entry.weightsPerColumn = weightsPerColumn;
+        entry.best = best;
+
+        // Loaded choices are final until retuned
+        entry.candidates = { entry.best };
+        entry.times = std::vector<double>(1, 0.0);
+        entry.counts = std::vector<int>(1, 0);
+        entry.trial = -1;
+    }
+}
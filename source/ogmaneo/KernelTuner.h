@@ -0,0 +1,108 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#pragma once
+
+#include "Helpers.h"
+
+#include <map>
+#include <array>
+
+namespace ogmaneo {
+// Chooses batch sizes (tile shapes) per kernel class and layer shape.
+// New shapes start from a cache-based guess, then each candidate is timed on live launches and the fastest is kept
+class KernelTuner {
+public:
+    typedef std::array<int, 5> Key; // kernelClass, size, radius
+
+private:
+    struct Entry {
+        std::vector<Int2> candidates; // Batch sizes to try (x only for 1D kernels), first is the guess
+        std::vector<double> times; // Accumulated seconds per candidate
+        std::vector<int> counts; // Timed launches per candidate
+        Int2 best; // Chosen batch size
+        int trial; // Launches handed out while tuning, -1 once tuned
+        int weightsPerColumn; // From the shape, kept to rebuild candidates
+
+        Entry()
+        :
+        best(1, 1),
+        trial(-1),
+        weightsPerColumn(0)
+        {}
+    };
+
+    std::map<Key, Entry> entries;
+
+    Entry &getEntry(
+        const KernelShape &shape
+    );
+
+    void initEntry(
+        const KernelShape &shape,
+        Entry &entry
+    ) const;
+
+public:
+    std::vector<Int2> candidates2; // Tile shapes tried for 2D kernels
+    std::vector<int> candidates1; // Batch sizes tried for 1D kernels
+
+    int trialsPerCandidate; // Timed launches per candidate, after one untimed warm-up round
+
+    int cacheBytes; // Per-core cache (L2) budget for the initial guess
+
+    bool tuning; // Whether new shapes are tuned, otherwise they keep the initial guess
+
+    KernelTuner();
+
+    // Batch size to use for a launch. Returns the trial index to pass to endLaunch, or -1 if not timing
+    int beginLaunch(
+        const KernelShape &shape, // Launch shape
+        Int2 &batchSize // Batch size to use (x only for 1D kernels)
+    );
+
+    // Report the duration of a timed launch
+    void endLaunch(
+        const KernelShape &shape, // Launch shape
+        int trial, // Value returned by beginLaunch
+        double seconds // Duration of the launch
+    );
+
+    // Tune all known shapes again (on demand, e.g. after changing the thread count)
+    void retune();
+
+    // Whether any shape is still being tuned
+    bool isTuning() const;
+
+    // Chosen batch size for a shape, or the initial guess if it is unknown or not yet tuned
+    Int2 getBatchSize(
+        const KernelShape &shape
+    ) const;
+
+    // Remove all shapes
+    void clear() {
+        entries.clear();
+    }
+
+    // Number of known shapes
+    int size() const {
+        return entries.size();
+    }
+
+    // Write chosen batch sizes to stream, along with the thread count they were tuned for
+    void writeToStream(
+        std::ostream &os // Stream to write to
+    ) const;
+
+    // Read chosen batch sizes from stream, merges with (and overrides) known shapes.
+    // Choices tuned for a different thread count (omp_get_max_threads) are skipped
+    void readFromStream(
+        std::istream &is // Stream to read from
+    );
+};
+} // namespace ogmaneo
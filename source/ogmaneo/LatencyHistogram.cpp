@@ -0,0 +1,170 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+using namespace ogmaneo;
+
+static const int subBucketCount = 1 << LatencyHistogram::subBucketBits;
+static const int halfSubBucketCount = subBucketCount / 2;
+
+// Covers all non-negative long long values
+static const int numBuckets = subBucketCount + (63 - LatencyHistogram::subBucketBits) * halfSubBucketCount;
+
+static int highestBit(
+    unsigned long long value
+) {
+    int bit = 0;
+
+    while (value >>= 1)
+        bit++;
+
+    return bit;
+}
+
+static int bucketIndex(
+    long long value
+) {
+    if (value < subBucketCount)
+        return std::max(0ll, value);
+
+    // Keep the top subBucketBits bits
+    int msb = highestBit(value);
+    int shift = msb - (LatencyHistogram::subBucketBits - 1);
+
+    return std::min(numBuckets - 1, subBucketCount + (msb - LatencyHistogram::subBucketBits) * halfSubBucketCount + static_cast<int>(value >> shift) - halfSubBucketCount);
+}
+
+// Middle of the range of values in a bucket
+static double bucketValue(
+    int index
+) {
+    if (index < subBucketCount)
+        return index;
+
+    int group = (index - subBucketCount) / halfSubBucketCount;
+    int sub = (index - subBucketCount) % halfSubBucketCount + halfSubBucketCount;
+    int shift = group + 1;
+
+    double lower = std::ldexp(static_cast<double>(sub), shift);
+
+    return lower + std::ldexp(0.5, shift);
+}
+
+LatencyHistogram::LatencyHistogram()
+:
+counts(numBuckets, 0),
+total(0),
+minValue(std::numeric_limits<long long>::max()),
+maxValue(0),
+sum(0.0)
+{}
+
+void LatencyHistogram::record(
+    long long nanoseconds
+) {
+    nanoseconds = std::max(0ll, nanoseconds);
+
+    counts[bucketIndex(nanoseconds)]++;
+
+    total++;
+    minValue = std::min(minValue, nanoseconds);
+    maxValue = std::max(maxValue, nanoseconds);
+    sum += nanoseconds;
+}
+
+void LatencyHistogram::merge(
+    const LatencyHistogram &other
+) {
+    for (int i = 0; i < numBuckets; i++)
+        counts[i] += other.counts[i];
+
+    total += other.total;
+    minValue = std::min(minValue, other.minValue);
+    maxValue = std::max(maxValue, other.maxValue);
+    sum += other.sum;
+}
+
+void LatencyHistogram::clear() {
+    std::fill(counts.begin(), counts.end(), 0);
+
+    total = 0;
+    minValue = std::numeric_limits<long long>::max();
+    maxValue = 0;
+    sum = 0.0;
+}
+
+double LatencyHistogram::getMean() const {
+    if (total == 0)
+        return 0.0;
+
+    return sum / total * 1e-9;
+}
+
+double LatencyHistogram::getPercentile(
+    double percentile
+) const {
+    if (total == 0)
+        return 0.0;
+
+    // Rank of the value, at least the first
+    long long rank = std::max(1ll, static_cast<long long>(std::ceil(std::min(1.0, std::max(0.0, percentile)) * total)));
+
+    long long cumulative = 0;
+
+    for (int i = 0; i < numBuckets; i++) {
+        cumulative += counts[i];
+
+        if (cumulative >= rank)
+            return std::min(static_cast<double>(maxValue), std::max(static_cast<double>(minValue), bucketValue(i))) * 1e-9;
+    }
+
+    return maxValue * 1e-9;
+}
+
+LatencySummary LatencyHistogram::getSummary() const {
+    LatencySummary summary;
+
+    summary.count = total;
+    summary.mean = getMean();
+    summary.min = total == 0 ? 0.0 : minValue * 1e-9;
+    summary.p50 = getPercentile(0.5);
+    summary.p90 = getPercentile(0.9);
+    summary.p99 = getPercentile(0.99);
+    summary.p999 = getPercentile(0.999);
+    summary.max = maxValue * 1e-9;
+
+    return summary;
+}
+
+void StepLatencies::merge(
+    const StepLatencies &other
+) {
+    step.merge(other.step);
+    inference.merge(other.inference);
+    learning.merge(other.learning);
+
+    if (layers.size() < other.layers.size())
+        layers.resize(other.layers.size());
+
+    for (int l = 0; l < other.layers.size(); l++)
+        layers[l].merge(other.layers[l]);
+}
+
+void StepLatencies::clear() {
+    step.clear();
+    inference.clear();
+    learning.clear();
+
+    for (int l = 0; l < layers.size(); l++)
+        layers[l].clear();
+}
@@ -0,0 +1,100 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+#include <chrono>
+
+namespace ogmaneo {
+// Percentiles of a histogram, in seconds
+struct LatencySummary {
+    long long count;
+    double mean;
+    double min;
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+    double max;
+};
+
+// Log-linear (HDR style) histogram of durations with nanosecond resolution.
+// Buckets have about 3% relative width from 64ns up, values below that are exact
+class LatencyHistogram {
+public:
+    static const int subBucketBits = 6; // 2^subBucketBits linear buckets per power of two
+
+private:
+    std::vector<long long> counts;
+
+    long long total;
+    long long minValue;
+    long long maxValue;
+    double sum;
+
+public:
+    LatencyHistogram();
+
+    // Record a duration in nanoseconds
+    void record(
+        long long nanoseconds
+    );
+
+    // Record a duration
+    void record(
+        std::chrono::steady_clock::duration duration
+    ) {
+        record(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+    }
+
+    // Add all values of another histogram
+    void merge(
+        const LatencyHistogram &other
+    );
+
+    // Remove all values
+    void clear();
+
+    // Number of recorded values
+    long long getCount() const {
+        return total;
+    }
+
+    // Mean in seconds
+    double getMean() const;
+
+    // Value at a percentile (0-1, e.g. 0.99 for p99) in seconds, 0 if empty
+    double getPercentile(
+        double percentile
+    ) const;
+
+    // Common percentiles at once
+    LatencySummary getSummary() const;
+};
+
+// Latencies of Hierarchy steps, enabled by pointing ComputeSystem::stepLatencies at one.
+// step: every public step call (step, stepPipelined, stepDeferred, stepBudgeted), whole call.
+// inference: forward passes without inline learning (learnEnabled false, deferred steps).
+// learning: steps that learn inline, and learnDeferred calls (also the learning part of stepBudgeted).
+// layers: update of each layer (sparse coder, its predictors and, for the first layer, actors) within a step
+struct StepLatencies {
+    LatencyHistogram step;
+    LatencyHistogram inference;
+    LatencyHistogram learning;
+    std::vector<LatencyHistogram> layers;
+
+    // Add all values of another instance
+    void merge(
+        const StepLatencies &other
+    );
+
+    // Remove all values
+    void clear();
+};
+} // namespace ogmaneo
@@ -0,0 +1,155 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#include "LazyModel.h"
+
+using namespace ogmaneo;
+
+bool LazyModel::open(
+    const std::string &fileName,
+    TopologyCache* topologyCache
+) {
+    close();
+
+    reader.topologyCache = topologyCache;
+
+    // Deltas need a base to apply to
+    if (!reader.open(fileName) || (reader.getFlags() & modelFlagDelta) != 0) {
+        close();
+
+        return false;
+    }
+
+    // Layer counts follow from the section table alone
+    int numLayers = 0;
+    int numInputs = 0;
+
+    for (int i = 0; i < reader.getNumSections(); i++) {
+        const SectionDesc &desc = reader.getSection(i);
+
+        if (desc.type == sectionSparseCoder)
+            numLayers = std::max(numLayers, desc.layer + 1);
+        else if (desc.type == sectionActor)
+            numInputs = std::max(numInputs, desc.index + 1);
+    }
+
+    scLayers.resize(numLayers);
+    pLayers.resize(numLayers);
+    aLayers.resize(numInputs);
+
+    for (int i = 0; i < reader.getNumSections(); i++) {
+        const SectionDesc &desc = reader.getSection(i);
+
+        if (desc.type == sectionPredictor && desc.layer >= 0 && desc.layer < numLayers && desc.index >= 0)
+            pLayers[desc.layer].resize(std::max<int>(pLayers[desc.layer].size(), desc.index + 1));
+    }
+
+    return true;
+}
+
+void LazyModel::close() {
+    reader.close();
+
+    scLayers.clear();
+    pLayers.clear();
+    aLayers.clear();
+}
+
+SparseCoder* LazyModel::getSCLayer(
+    int l
+) {
+    if (l < 0 || l >= scLayers.size())
+        return nullptr;
+
+    if (scLayers[l] == nullptr) {
+        int sectionIndex = reader.findSection(sectionSparseCoder, l, -1);
+
+        if (sectionIndex == -1)
+            return nullptr;
+
+        SectionReader sr = reader.getSectionReader(sectionIndex);
+
+        std::unique_ptr<SparseCoder> layer = std::make_unique<SparseCoder>();
+
+        layer->readFromSection(sr);
+
+        if (sr.getFailed())
+            return nullptr;
+
+        scLayers[l] = std::move(layer);
+    }
+
+    return scLayers[l].get();
+}
+
+Predictor* LazyModel::getPLayer(
+    int l,
+    int v
+) {
+    if (l < 0 || l >= pLayers.size() || v < 0 || v >= pLayers[l].size())
+        return nullptr;
+
+    if (pLayers[l][v] == nullptr) {
+        int sectionIndex = reader.findSection(sectionPredictor, l, v);
+
+        if (sectionIndex == -1)
+            return nullptr;
+
+        SectionReader sr = reader.getSectionReader(sectionIndex);
+
+        std::unique_ptr<Predictor> layer = std::make_unique<Predictor>();
+
+        layer->readFromSection(sr);
+
+        if (sr.getFailed())
+            return nullptr;
+
+        pLayers[l][v] = std::move(layer);
+    }
+
+    return pLayers[l][v].get();
+}
+
+Actor* LazyModel::getALayer(
+    int v
+) {
+    if (v < 0 || v >= aLayers.size())
+        return nullptr;
+
+    if (aLayers[v] == nullptr) {
+        int sectionIndex = reader.findSection(sectionActor, 0, v);
+
+        if (sectionIndex == -1)
+            return nullptr;
+
+        SectionReader sr = reader.getSectionReader(sectionIndex);
+
+        std::unique_ptr<Actor> layer = std::make_unique<Actor>();
+
+        layer->readFromSection(sr, actorHistories);
+
+        if (sr.getFailed())
+            return nullptr;
+
+        aLayers[v] = std::move(layer);
+    }
+
+    return aLayers[v].get();
+}
+
+void LazyModel::unloadLayer(
+    int l
+) {
+    if (l < 0 || l >= scLayers.size())
+        return;
+
+    scLayers[l] = nullptr;
+
+    for (int v = 0; v < pLayers[l].size(); v++)
+        pLayers[l][v] = nullptr;
+}
@@ -0,0 +1,91 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#pragma once
+
+#include "SparseCoder.h"
+#include "Predictor.h"
+#include "Actor.h"
+
+#include <memory>
+
+namespace ogmaneo {
+// Loads individual layers of a model file on first access, layers that are never requested are never parsed or allocated.
+// Meant for tools that only use part of a hierarchy (e.g. encoding inputs with the first layer)
+class LazyModel {
+private:
+    ModelFileReader reader;
+
+    // Loaded layers, nullptr until requested
+    std::vector<std::unique_ptr<SparseCoder>> scLayers;
+    std::vector<std::vector<std::unique_ptr<Predictor>>> pLayers;
+    std::vector<std::unique_ptr<Actor>> aLayers;
+
+public:
+    bool actorHistories; // Whether to load actor replay histories (needed for actors to learn), applies to subsequently loaded actors
+
+    LazyModel()
+    :
+    actorHistories(false)
+    {}
+
+    // Open a (non-delta) model file, only the section table is read. Returns false on failure
+    bool open(
+        const std::string &fileName, // Name of file to open
+        TopologyCache* topologyCache = nullptr // Optional cache to take weight topologies from instead of the file
+    );
+
+    // Close the file and release all loaded layers
+    void close();
+
+    // Get the number of layers (scLayers)
+    int getNumLayers() const {
+        return scLayers.size();
+    }
+
+    // Get the number of predictor slots of a layer (up to the last present predictor, some may be empty)
+    int getNumPLayers(
+        int l // Layer index
+    ) const {
+        return pLayers[l].size();
+    }
+
+    // Get the number of actor slots (up to the last present actor, some may be empty)
+    int getNumALayers() const {
+        return aLayers.size();
+    }
+
+    // Get a sparse coder, loading it if needed. Returns nullptr if invalid
+    SparseCoder* getSCLayer(
+        int l // Layer index
+    );
+
+    // Get a predictor, loading it if needed. Returns nullptr if not present or invalid
+    Predictor* getPLayer(
+        int l, // Layer index
+        int v // Predictor index within layer
+    );
+
+    // Get an actor, loading it if needed. Returns nullptr if not present or invalid
+    Actor* getALayer(
+        int v // Input index
+    );
+
+    // Whether a layer has been loaded
+    bool isSCLayerLoaded(
+        int l
+    ) const {
+        return scLayers[l] != nullptr;
+    }
+
+    // Release a loaded layer (and its predictors), it will be loaded again on next access. Out of range indices are ignored
+    void unloadLayer(
+        int l // Layer index
+    );
+};
+} // namespace ogmaneo
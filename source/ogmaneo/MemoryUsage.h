@@ -0,0 +1,61 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+
+namespace ogmaneo {
+// Bytes allocated for buffer contents, by category. Container headers and object sizes are not counted
+struct MemoryUsage {
+    long long weights; // Weight values
+    long long topology; // Row ranges and column indices of weight matrices
+    long long transpose; // Transpose index arrays of weight matrices
+    long long states; // Hidden states, activations, reconstructions and previous inputs
+    long long histories; // Hierarchy input histories
+    long long replay; // Actor history samples and replay priorities
+    long long other; // Dirty flags, kernel partitions and step scratch
+
+    MemoryUsage()
+    :
+    weights(0),
+    topology(0),
+    transpose(0),
+    states(0),
+    histories(0),
+    replay(0),
+    other(0)
+    {}
+
+    long long total() const {
+        return weights + topology + transpose + states + histories + replay + other;
+    }
+
+    MemoryUsage &operator+=(
+        const MemoryUsage &other
+    ) {
+        weights += other.weights;
+        topology += other.topology;
+        transpose += other.transpose;
+        states += other.states;
+        histories += other.histories;
+        replay += other.replay;
+        this->other += other.other;
+
+        return *this;
+    }
+};
+
+// Allocated bytes of a vector's elements
+template<typename T>
+long long vectorMemory(
+    const std::vector<T> &v
+) {
+    return static_cast<long long>(v.capacity()) * sizeof(T);
+}
+} // namespace ogmaneo
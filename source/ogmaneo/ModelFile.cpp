@@ -0,0 +1,493 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#include "ModelFile.h"
+
+#include <fstream>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define OGMANEO_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace ogmaneo;
+
+const char modelFileMagic[4] = { 'O', 'G', 'N', '2' };
+const int headerSize = 64;
+const int sectionDescSize = 32;
+
+bool ModelFileReader::open(
+    const std::string &fileName
+) {
+    close();
+
+#ifdef OGMANEO_MMAP
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+
+        return false;
+    }
+
+    void* m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // Mapping stays valid after the descriptor is closed
+    ::close(fd);
+
+    if (m == MAP_FAILED)
+        return false;
+
+    mapping = m;
+    data = static_cast<const char*>(m);
+    size = st.st_size;
+#else
+    std::ifstream is(fileName, std::ios::binary | std::ios::ate);
+
+    if (!is.is_open())
+        return false;
+
+    fallback.resize(static_cast<size_t>(is.tellg()));
+
+    is.seekg(0);
+    is.read(fallback.data(), fallback.size());
+
+    data = fallback.data();
+    size = fallback.size();
+#endif
+
+    if (!parse()) {
+        close();
+
+        return false;
+    }
+
+    return true;
+}
+
+void ModelFileReader::adviseSection(
+    int i
+) const {
+#ifdef OGMANEO_MMAP
+    if (mapping == nullptr || sections[i].size == 0)
+        return;
+
+    // Only sections that are decoded get paged in, so lazy loading stays lazy
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+
+    size_t begin = sections[i].offset / pageSize * pageSize;
+
+    madvise(static_cast<char*>(mapping) + begin, sections[i].offset + sections[i].size - begin, MADV_WILLNEED);
+#endif
+}
+
+bool ModelFileReader::open(
+    const char* data,
+    size_t size
+) {
+    close();
+
+    this->data = data;
+    this->size = size;
+
+    if (!parse()) {
+        close();
+
+        return false;
+    }
+
+    return true;
+}
+
+void ModelFileReader::close() {
+#ifdef OGMANEO_MMAP
+    if (mapping != nullptr)
+        munmap(mapping, size);
+#endif
+
+    mapping = nullptr;
+
+    fallback.clear();
+    fallback.shrink_to_fit();
+
+    data = nullptr;
+    size = 0;
+    flags = 0;
+
+    sections.clear();
+}
+
+bool ModelFileReader::parse() {
+    SectionReader hr(data, size);
+
+    char magic[4];
+
+    for (int i = 0; i < 4; i++)
+        magic[i] = hr.read<char>();
+
+    if (std::memcmp(magic, modelFileMagic, 4) != 0)
+        return false;
+
+    int version = hr.read<int>();
+
+    // Newer versions may change the layout
+    if (version < 1 || version > modelFileVersion)
+        return false;
+
+    int numSections = hr.read<int>();
+
+    flags = hr.read<int>();
+
+    unsigned long long tableOffset = hr.read<unsigned long long>();
+
+    if (hr.getFailed() || numSections < 0 || tableOffset > size || (size - tableOffset) / sectionDescSize < static_cast<size_t>(numSections))
+        return false;
+
+    SectionReader tr(data + tableOffset, size - tableOffset);
+
+    sections.resize(numSections);
+
+    for (int i = 0; i < numSections; i++) {
+        SectionDesc &desc = sections[i];
+
+        desc.type = tr.read<int>();
+        desc.layer = tr.read<int>();
+        desc.index = tr.read<int>();
+        desc.reserved = tr.read<int>();
+        desc.offset = tr.read<unsigned long long>();
+        desc.size = tr.read<unsigned long long>();
+
+        if (desc.offset > size || desc.size > size - desc.offset)
+            return false;
+    }
+
+    return !tr.getFailed();
+}
+
+int ModelFileReader::findSection(
+    int type,
+    int layer,
+    int index
+) const {
+    for (int i = 0; i < sections.size(); i++) {
+        if (sections[i].type == type && sections[i].layer == layer && sections[i].index == index)
+            return i;
+    }
+
+    return -1;
+}
+
+void ogmaneo::writeModelToStream(
+    std::ostream &os,
+    const std::vector<SectionDesc> &descs,
+    const std::vector<SectionWriter> &sections,
+    int flags
+) {
+    assert(descs.size() == sections.size());
+
+    // Lay out sections
+    std::vector<SectionDesc> table = descs;
+
+    unsigned long long offset = headerSize;
+
+    for (int i = 0; i < table.size(); i++) {
+        offset = (offset + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+
+        table[i].offset = offset;
+        table[i].size = sections[i].data.size();
+
+        offset += table[i].size;
+    }
+
+    unsigned long long tableOffset = (offset + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+
+    // Header
+    SectionWriter hw;
+
+    for (int i = 0; i < 4; i++)
+        hw.write(modelFileMagic[i]);
+
+    hw.write(modelFileVersion);
+    hw.write(static_cast<int>(table.size()));
+    hw.write(flags);
+    hw.write(tableOffset);
+
+    hw.data.resize(headerSize, 0);
+
+    os.write(hw.data.data(), hw.data.size());
+
+    // Sections
+    std::vector<char> padding(sectionAlignment, 0);
+
+    offset = headerSize;
+
+    for (int i = 0; i < table.size(); i++) {
+        os.write(padding.data(), table[i].offset - offset);
+        os.write(sections[i].data.data(), sections[i].data.size());
+
+        offset = table[i].offset + table[i].size;
+    }
+
+    os.write(padding.data(), tableOffset - offset);
+
+    // Section table
+    SectionWriter tw;
+
+    for (int i = 0; i < table.size(); i++) {
+        tw.write(table[i].type);
+        tw.write(table[i].layer);
+        tw.write(table[i].index);
+        tw.write(table[i].reserved);
+        tw.write(table[i].offset);
+        tw.write(table[i].size);
+    }
+
+    os.write(tw.data.data(), tw.data.size());
+}
+
+void ogmaneo::writeSMToSection(
+    SectionWriter &sw,
+    const SparseMatrix &mat
+) {
+    sw.write(mat.rows);
+    sw.write(mat.columns);
+
+    sw.writeBuffer(mat.nonZeroValues);
+    sw.writeBuffer(mat.nonZeroValueIndices);
+    sw.writeBuffer(mat.rowRanges);
+    sw.writeBuffer(mat.columnIndices);
+    sw.writeBuffer(mat.columnRanges);
+    sw.writeBuffer(mat.rowIndices);
+}
+
+void ogmaneo::readSMFromSection(
+    SectionReader &sr,
+    SparseMatrix &mat
+) {
+    // Replaced matrix is no longer tracked
+    mat.clearDirty();
+
+    mat.rows = sr.read<int>();
+    mat.columns = sr.read<int>();
+
+    sr.readBuffer(mat.nonZeroValues);
+    sr.readBuffer(mat.nonZeroValueIndices);
+    sr.readBuffer(mat.rowRanges);
+    sr.readBuffer(mat.columnIndices);
+    sr.readBuffer(mat.columnRanges);
+    sr.readBuffer(mat.rowIndices);
+}
+
+static void writeSMDeltaToSection(
+    SectionWriter &sw,
+    const SparseMatrix &mat
+) {
+    sw.write(mat.rows);
+    sw.write(mat.columns);
+    sw.write(static_cast<int>(mat.nonZeroValues.size()));
+
+    int blockSize = mat.getDirtyBlockSize();
+    int numBlocks = (mat.nonZeroValues.size() + blockSize - 1) / blockSize;
+
+    sw.write(blockSize);
+
+    // Untracked matrices are written in full
+    IntBuffer blocks;
+
+    for (int b = 0; b < numBlocks; b++) {
+        if (mat.dirtyBlocks.empty() || mat.dirtyBlocks[b])
+            blocks.push_back(b);
+    }
+
+    sw.writeBuffer(blocks);
+
+    FloatBuffer values;
+
+    for (int i = 0; i < blocks.size(); i++) {
+        int begin = blocks[i] * blockSize;
+        int end = std::min<int>(begin + blockSize, mat.nonZeroValues.size());
+
+        values.insert(values.end(), mat.nonZeroValues.begin() + begin, mat.nonZeroValues.begin() + end);
+    }
+
+    sw.writeBuffer(values);
+}
+
+static void readSMDeltaFromSection(
+    SectionReader &sr,
+    SparseMatrix &mat
+) {
+    int rows = sr.read<int>();
+    int columns = sr.read<int>();
+    int numValues = sr.read<int>();
+    int blockSize = sr.read<int>();
+
+    IntBuffer blocks;
+    FloatBuffer values;
+
+    sr.readBuffer(blocks);
+    sr.readBuffer(values);
+
+    // Must apply to a matrix of the same shape
+    if (sr.getFailed() || mat.rows != rows || mat.columns != columns || mat.nonZeroValues.size() != numValues || blockSize <= 0) {
+        sr.fail();
+
+        return;
+    }
+
+    int numBlocks = (numValues + blockSize - 1) / blockSize;
+
+    int offset = 0;
+
+    for (int i = 0; i < blocks.size(); i++) {
+        if (blocks[i] < 0 || blocks[i] >= numBlocks) {
+            sr.fail();
+
+            return;
+        }
+
+        int begin = blocks[i] * blockSize;
+        int end = std::min(begin + blockSize, numValues);
+
+        if (offset + end - begin > values.size()) {
+            sr.fail();
+
+            return;
+        }
+
+        std::copy(values.begin() + offset, values.begin() + offset + end - begin, mat.nonZeroValues.begin() + begin);
+
+        offset += end - begin;
+    }
+}
+
+void ogmaneo::writeLocalRFSMToSection(
+    SectionWriter &sw,
+    const SparseMatrix &mat
+) {
+    if (sw.delta) {
+        writeSMDeltaToSection(sw, mat);
+
+        return;
+    }
+
+    if (!sw.compact) {
+        writeSMToSection(sw, mat);
+
+        return;
+    }
+
+    sw.write(mat.rows);
+    sw.write(mat.columns);
+
+    sw.write(static_cast<char>(!mat.columnRanges.empty()));
+
+    sw.writeBuffer(mat.nonZeroValues);
+}
+
+void ogmaneo::readLocalRFSMFromSection(
+    SectionReader &sr,
+    const Int3 &inSize,
+    const Int3 &outSize,
+    int radius,
+    SparseMatrix &mat
+) {
+    if (sr.delta) {
+        readSMDeltaFromSection(sr, mat);
+
+        return;
+    }
+
+    if (!sr.compact) {
+        if (sr.topologyCache == nullptr) {
+            readSMFromSection(sr, mat);
+
+            return;
+        }
+
+        // Full topology is stored, but replicas share the cached one and only take the values from the file
+        int rows = sr.read<int>();
+        int columns = sr.read<int>();
+
+        FloatBuffer values;
+
+        sr.readBuffer(values);
+
+        // Same order as writeSMToSection
+        int numNonZeroValueIndices = sr.skipBuffer<int>();
+        int numRowRanges = sr.skipBuffer<int>();
+        int numColumnIndices = sr.skipBuffer<int>();
+        int numColumnRanges = sr.skipBuffer<int>();
+        int numRowIndices = sr.skipBuffer<int>();
+
+        if (sr.getFailed())
+            return;
+
+        mat.clearDirty();
+
+        sr.topologyCache->initSMLocalRF(inSize, outSize, radius, numColumnRanges > 0, mat);
+
+        if (mat.rows != rows || mat.columns != columns || mat.nonZeroValues.size() != values.size() ||
+            mat.nonZeroValueIndices.size() != numNonZeroValueIndices || mat.rowRanges.size() != numRowRanges ||
+            mat.columnIndices.size() != numColumnIndices || mat.columnRanges.size() != numColumnRanges || mat.rowIndices.size() != numRowIndices) {
+            sr.fail();
+
+            return;
+        }
+
+        mat.nonZeroValues.swap(values);
+
+        return;
+    }
+
+    int rows = sr.read<int>();
+    int columns = sr.read<int>();
+
+    bool transpose = sr.read<char>();
+
+    // Reject sizes the stored values cannot cover before generating the topology (every row has at least inSize.z nonzeros)
+    if (radius < 0 || rows != outSize.x * outSize.y * outSize.z || columns != inSize.x * inSize.y * inSize.z ||
+        static_cast<unsigned long long>(rows) * inSize.z * sizeof(float) > sr.getRemaining())
+        sr.fail();
+
+    if (sr.getFailed())
+        return;
+
+    mat.clearDirty();
+
+    if (sr.topologyCache != nullptr)
+        sr.topologyCache->initSMLocalRF(inSize, outSize, radius, transpose, mat);
+    else {
+        initSMLocalRF(inSize, outSize, radius, mat);
+
+        if (transpose)
+            mat.initT();
+        else {
+            mat.nonZeroValueIndices.clear();
+            mat.columnRanges.clear();
+            mat.rowIndices.clear();
+        }
+    }
+
+    int numNonZeros = mat.nonZeroValues.size();
+
+    sr.readBuffer(mat.nonZeroValues);
+
+    // Must match the regenerated topology
+    if (mat.rows != rows || mat.columns != columns || mat.nonZeroValues.size() != numNonZeros)
+        sr.fail();
+}
\ No newline at end of file
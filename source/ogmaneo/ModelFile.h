@@ -0,0 +1,416 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#pragma once
+
+#include "TopologyCache.h"
+
+#include <string>
+#include <cstring>
+
+namespace ogmaneo {
+// --- Model File Format ---
+//
+// Header (64 bytes), then sections, then the section table. Every section starts on a sectionAlignment
+// boundary and every buffer inside a section on a bufferAlignment boundary (relative to the file start).
+// All fields are written explicitly (no struct dumps), little endian as on the host.
+
+const int modelFileVersion = 1;
+const int sectionAlignment = 64;
+const int bufferAlignment = 16;
+
+// Header flags
+const int modelFlagCompact = 1; // Local receptive field topologies are omitted and regenerated on load
+const int modelFlagDelta = 2; // Only changed weight blocks are stored, applied on top of an existing model
+
+// Type of a section
+enum SectionType {
+    sectionHierarchy = 0,
+    sectionHistories = 1,
+    sectionSparseCoder = 2,
+    sectionPredictor = 3,
+    sectionActor = 4
+};
+
+struct SectionDesc {
+    int type; // SectionType
+    int layer; // Layer index, -1 if not applicable
+    int index; // Index within layer (e.g. predictor or input index), -1 if not applicable
+    int reserved;
+    unsigned long long offset; // Offset from the file start
+    unsigned long long size; // Size in bytes (excluding padding)
+
+    SectionDesc()
+    :
+    type(0),
+    layer(-1),
+    index(-1),
+    reserved(0),
+    offset(0),
+    size(0)
+    {}
+
+    SectionDesc(
+        int type,
+        int layer,
+        int index
+    )
+    :
+    type(type),
+    layer(layer),
+    index(index),
+    reserved(0),
+    offset(0),
+    size(0)
+    {}
+};
+
+// Encodes the contents of a section
+class SectionWriter {
+public:
+    std::vector<char> data;
+
+    bool compact; // Omit derivable topology
+    bool delta; // Only write changed weight blocks
+
+    SectionWriter()
+    :
+    compact(false),
+    delta(false)
+    {}
+
+    // Pad to a multiple of alignment
+    void align(
+        int alignment
+    ) {
+        data.resize((data.size() + alignment - 1) / alignment * alignment, 0);
+    }
+
+    // Write a plain scalar
+    template <typename T>
+    void write(
+        const T &value
+    ) {
+        size_t pos = data.size();
+
+        data.resize(pos + sizeof(T));
+
+        std::memcpy(&data[pos], &value, sizeof(T));
+    }
+
+    void writeInt3(
+        const Int3 &value
+    ) {
+        write(value.x);
+        write(value.y);
+        write(value.z);
+    }
+
+    // Write an element count followed by the (aligned) elements
+    template <typename T>
+    void writeBuffer(
+        const std::vector<T> &buf
+    ) {
+        int size = buf.size();
+
+        write(size);
+
+        align(bufferAlignment);
+
+        if (size > 0) {
+            size_t pos = data.size();
+
+            data.resize(pos + size * sizeof(T));
+
+            std::memcpy(&data[pos], buf.data(), size * sizeof(T));
+        }
+    }
+};
+
+// Decodes the contents of a section, reads past the end fail and yield zeros
+class SectionReader {
+private:
+    const char* data;
+    size_t size;
+    size_t pos;
+
+    bool failed;
+
+public:
+    bool compact; // Topology was omitted
+    bool delta; // Weights are patched onto existing matrices
+    TopologyCache* topologyCache; // Used to take topology from if not null
+
+    SectionReader(
+        const char* data,
+        size_t size
+    )
+    :
+    data(data),
+    size(size),
+    pos(0),
+    failed(false),
+    compact(false),
+    delta(false),
+    topologyCache(nullptr)
+    {}
+
+    void align(
+        int alignment
+    ) {
+        pos = (pos + alignment - 1) / alignment * alignment;
+    }
+
+    template <typename T>
+    T read() {
+        T value;
+
+        if (pos + sizeof(T) > size) {
+            failed = true;
+
+            std::memset(&value, 0, sizeof(T));
+
+            return value;
+        }
+
+        std::memcpy(&value, data + pos, sizeof(T));
+
+        pos += sizeof(T);
+
+        return value;
+    }
+
+    Int3 readInt3() {
+        Int3 value;
+
+        value.x = read<int>();
+        value.y = read<int>();
+        value.z = read<int>();
+        value.pad = 0;
+
+        return value;
+    }
+
+    // Read a layer size, fails unless all dimensions are positive and the volume fits in an int
+    Int3 readSize() {
+        Int3 value = readInt3();
+
+        if (value.x <= 0 || value.y <= 0 || value.z <= 0 ||
+            static_cast<long long>(value.x) * value.y * value.z > 0x7fffffffll) {
+            failed = true;
+
+            return Int3(0, 0, 0);
+        }
+
+        return value;
+    }
+
+    // Read an element count, fails if negative or if that many elements of at least minBytes each cannot fit in the rest of the section
+    int readCount(
+        size_t minBytes
+    ) {
+        int count = read<int>();
+
+        if (count < 0 || static_cast<unsigned long long>(count) * minBytes > getRemaining()) {
+            failed = true;
+
+            return 0;
+        }
+
+        return count;
+    }
+
+    template <typename T>
+    void readBuffer(
+        std::vector<T> &buf
+    ) {
+        int count = read<int>();
+
+        align(bufferAlignment);
+
+        if (count < 0 || pos + static_cast<size_t>(count) * sizeof(T) > size) {
+            failed = true;
+
+            buf.clear();
+
+            return;
+        }
+
+        buf.resize(count);
+
+        if (count > 0)
+            std::memcpy(buf.data(), data + pos, count * sizeof(T));
+
+        pos += count * sizeof(T);
+    }
+
+    // Skip a buffer written by writeBuffer, returns its number of elements (0 on failure)
+    template <typename T>
+    int skipBuffer() {
+        int count = read<int>();
+
+        align(bufferAlignment);
+
+        if (count < 0 || pos + static_cast<size_t>(count) * sizeof(T) > size) {
+            failed = true;
+
+            return 0;
+        }
+
+        pos += count * sizeof(T);
+
+        return count;
+    }
+
+    // Bytes left in the section
+    size_t getRemaining() const {
+        return pos < size ? size - pos : 0;
+    }
+
+    // Mark as failed (e.g. on inconsistent contents)
+    void fail() {
+        failed = true;
+    }
+
+    // Whether any read went out of bounds
+    bool getFailed() const {
+        return failed;
+    }
+};
+
+// Provides read access to a model file, memory mapped where supported.
+// Buffers are copied out of the mapping when read (layers own and update their weights), so the mapping
+// saves the stream copy and lets only the decoded sections be paged in, but is not zero-copy
+class ModelFileReader {
+private:
+    const char* data;
+    size_t size;
+
+    // Mapping (or fallback copy)
+    void* mapping;
+    std::vector<char> fallback;
+
+    int flags;
+
+    std::vector<SectionDesc> sections;
+
+    bool parse();
+
+    // Ask the OS to read a mapped section ahead (sections are decoded whole, possibly in parallel)
+    void adviseSection(
+        int i
+    ) const;
+
+public:
+    TopologyCache* topologyCache; // Optional cache weight topologies are taken from (not owned)
+
+    ModelFileReader()
+    :
+    data(nullptr),
+    size(0),
+    mapping(nullptr),
+    flags(0),
+    topologyCache(nullptr)
+    {}
+
+    ~ModelFileReader() {
+        close();
+    }
+
+    // Non-copyable (owns the mapping)
+    ModelFileReader(const ModelFileReader &other) = delete;
+    ModelFileReader &operator=(const ModelFileReader &other) = delete;
+
+    // Open and validate a file, returns false on failure
+    bool open(
+        const std::string &fileName
+    );
+
+    // Use an in-memory model (not copied, must outlive the reader)
+    bool open(
+        const char* data,
+        size_t size
+    );
+
+    void close();
+
+    int getNumSections() const {
+        return sections.size();
+    }
+
+    const SectionDesc &getSection(
+        int i
+    ) const {
+        return sections[i];
+    }
+
+    // Find a section, returns -1 if not present
+    int findSection(
+        int type,
+        int layer,
+        int index
+    ) const;
+
+    // Get header flags
+    int getFlags() const {
+        return flags;
+    }
+
+    // Get a reader over a section
+    SectionReader getSectionReader(
+        int i
+    ) const {
+        adviseSection(i);
+
+        SectionReader sr(data + sections[i].offset, sections[i].size);
+
+        sr.compact = (flags & modelFlagCompact) != 0;
+        sr.delta = (flags & modelFlagDelta) != 0;
+        sr.topologyCache = topologyCache;
+
+        return sr;
+    }
+};
+
+// Assemble a model file from encoded sections (descs only need type/layer/index set)
+void writeModelToStream(
+    std::ostream &os, // Stream to write to
+    const std::vector<SectionDesc> &descs, // Section descriptors
+    const std::vector<SectionWriter> &sections, // Section contents, same size as descs
+    int flags = 0 // Header flags
+);
+
+// --- Sparse Matrix Sections ---
+
+void writeSMToSection(
+    SectionWriter &sw, // Section to write to
+    const SparseMatrix &mat // Matrix to write
+);
+
+void readSMFromSection(
+    SectionReader &sr, // Section to read from
+    SparseMatrix &mat // Matrix to read
+);
+
+// Write a matrix created by initSMLocalRF, only values are written if the section is compact,
+// only dirty value blocks (all if not tracked) if it is a delta
+void writeLocalRFSMToSection(
+    SectionWriter &sw, // Section to write to
+    const SparseMatrix &mat // Matrix to write
+);
+
+// Read a matrix created by initSMLocalRF, regenerating its topology if the section is compact,
+// patching the existing matrix if it is a delta
+void readLocalRFSMFromSection(
+    SectionReader &sr, // Section to read from
+    const Int3 &inSize, // Size of input field
+    const Int3 &outSize, // Size of output field
+    int radius, // Radius of output onto input
+    SparseMatrix &mat // Matrix to read
+);
+} // namespace ogmaneo
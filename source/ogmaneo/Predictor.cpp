@@ -13,8 +13,10 @@ using namespace ogmaneo;
 void Predictor::forward(
     const Int2 &pos,
     std::mt19937 &rng,
-    const std::vector<const IntBuffer*> &inputCs
-) {
+    const std::vector<const IntBuffer*> &inputCs,
+    IntBuffer* hiddenCsOut,
+    FloatBuffer* hiddenActivationsOut
+) const {
     int maxIndex = 0;
     float maxActivation = -999999.0f;
 
@@ -26,7 +28,7 @@ void Predictor::forward(
 
         // For each visible layer
         for (int vli = 0; vli < visibleLayers.size(); vli++) {
-            VisibleLayer &vl = visibleLayers[vli];
+            const VisibleLayer &vl = visibleLayers[vli];
             const VisibleLayerDesc &vld = visibleLayerDescs[vli];
 
             sum += vl.weights.multiplyOHVs(*inputCs[vli], hiddenIndex, vld.size.z);
@@ -35,7 +37,7 @@ void Predictor::forward(
 
         sum /= count;
 
-        hiddenActivations[hiddenIndex] = sum;
+        (*hiddenActivationsOut)[hiddenIndex] = sum;
 
         if (sum > maxActivation) {
             maxActivation = sum;
@@ -43,7 +45,7 @@ void Predictor::forward(
         }
     }
 
-    hiddenCs[address2(pos, Int2(hiddenSize.x, hiddenSize.y))] = maxIndex;
+    (*hiddenCsOut)[address2(pos, Int2(hiddenSize.x, hiddenSize.y))] = maxIndex;
 }
 
 void Predictor::learn(
@@ -69,11 +71,29 @@ void Predictor::learn(
     }
 }
 
+KernelShape Predictor::getHiddenShape(
+    KernelClass kernelClass
+) const {
+    int numHiddenColumns = hiddenSize.x * hiddenSize.y;
+
+    int radius = 0;
+    int numWeights = 0;
+
+    for (int vli = 0; vli < visibleLayers.size(); vli++) {
+        radius = std::max(radius, visibleLayerDescs[vli].radius);
+        numWeights += visibleLayers[vli].weights.nonZeroValues.size();
+    }
+
+    return KernelShape(kernelClass, hiddenSize, radius, numWeights / numHiddenColumns);
+}
+
 void Predictor::initRandom(
     ComputeSystem &cs,
     const Int3 &hiddenSize,
     const std::vector<VisibleLayerDesc> &visibleLayerDescs
 ) {
+    hiddenPartition = KernelPartition();
+
     this->visibleLayerDescs = visibleLayerDescs;
 
     this->hiddenSize = hiddenSize;
@@ -84,8 +104,6 @@ void Predictor::initRandom(
     int numHiddenColumns = hiddenSize.x * hiddenSize.y;
     int numHidden = numHiddenColumns * hiddenSize.z;
 
-    std::uniform_real_distribution<float> weightDist(-0.01f, 0.01f);
-
     // Create layers
     for (int vli = 0; vli < visibleLayers.size(); vli++) {
         VisibleLayer &vl = visibleLayers[vli];
@@ -94,10 +112,9 @@ void Predictor::initRandom(
         int numVisibleColumns = vld.size.x * vld.size.y;
 
         // Create weight matrix for this visible layer and initialize randomly
-        initSMLocalRF(vld.size, hiddenSize, vld.radius, vl.weights);
+        initSMLocalRF(cs, vld.size, hiddenSize, vld.radius, false, vl.weights);
 
-        for (int i = 0; i < vl.weights.nonZeroValues.size(); i++)
-            vl.weights.nonZeroValues[i] = weightDist(cs.rng);
+        initSMUniform(cs.rng, -0.01f, 0.01f, vl.weights);
 
         vl.inputCsPrev = IntBuffer(numVisibleColumns, 0);
     }
@@ -113,7 +130,7 @@ void Predictor::activate(
     const std::vector<const IntBuffer*> &inputCs
 ) {
     // Forward kernel
-    runKernel2(cs, std::bind(Predictor::forwardKernel, std::placeholders::_1, std::placeholders::_2, this, inputCs), Int2(hiddenSize.x, hiddenSize.y), cs.rng, cs.batchSize2);
+    runKernel2(cs, std::bind(Predictor::forwardKernel, std::placeholders::_1, std::placeholders::_2, this, inputCs, &hiddenCs, &hiddenActivations), Int2(hiddenSize.x, hiddenSize.y), cs.rng, getHiddenShape(kernelPForward), getHiddenPartition(cs, *this, hiddenPartition));
 
     // Copy to prevs
     for (int vli = 0; vli < visibleLayers.size(); vli++) {
@@ -122,16 +139,26 @@ void Predictor::activate(
 
         int numVisibleColumns = vld.size.x * vld.size.y;
 
-        runKernel1(cs, std::bind(copyInt, std::placeholders::_1, std::placeholders::_2, inputCs[vli], &vl.inputCsPrev), numVisibleColumns, cs.rng, cs.batchSize1);
+        runKernel1(cs, std::bind(copyInt, std::placeholders::_1, std::placeholders::_2, inputCs[vli], &vl.inputCsPrev), numVisibleColumns, cs.rng, copyShape(numVisibleColumns));
     }
 }
 
+void Predictor::activate(
+    ComputeSystem &cs,
+    const std::vector<const IntBuffer*> &inputCs,
+    IntBuffer* hiddenCsOut,
+    FloatBuffer* hiddenActivationsOut
+) const {
+    // No cost-balanced partition, it is cached in the layer
+    runKernel2(cs, std::bind(Predictor::forwardKernel, std::placeholders::_1, std::placeholders::_2, this, inputCs, hiddenCsOut, hiddenActivationsOut), Int2(hiddenSize.x, hiddenSize.y), cs.rng, getHiddenShape(kernelPForward), nullptr);
+}
+
 void Predictor::learn(
     ComputeSystem &cs,
     const IntBuffer* hiddenTargetCs
 ) {
     // Learn kernel
-    runKernel2(cs, std::bind(Predictor::learnKernel, std::placeholders::_1, std::placeholders::_2, this, hiddenTargetCs), Int2(hiddenSize.x, hiddenSize.y), cs.rng, cs.batchSize2);
+    runKernel2(cs, std::bind(Predictor::learnKernel, std::placeholders::_1, std::placeholders::_2, this, hiddenTargetCs), Int2(hiddenSize.x, hiddenSize.y), cs.rng, getHiddenShape(kernelPLearn), getHiddenPartition(cs, *this, hiddenPartition));
 }
 
 void Predictor::writeToStream(
@@ -162,8 +189,11 @@ void Predictor::writeToStream(
 }
 
 void Predictor::readFromStream(
-    std::istream &is
+    std::istream &is,
+    TopologyCache* topologyCache
 ) {
+    hiddenPartition = KernelPartition();
+
     is.read(reinterpret_cast<char*>(&hiddenSize), sizeof(Int3));
 
     is.read(reinterpret_cast<char*>(&alpha), sizeof(float));
@@ -185,8 +215,122 @@ void Predictor::readFromStream(
 
         is.read(reinterpret_cast<char*>(&vld), sizeof(VisibleLayerDesc));
 
-        readSMFromStream(is, vl.weights);
+        readLocalRFSMFromStream(is, vld.size, hiddenSize, vld.radius, topologyCache, vl.weights);
 
         readBufferFromStream(is, &vl.inputCsPrev);
     }
-}
\ No newline at end of file
+}
+
+void Predictor::writeToSection(
+    SectionWriter &sw
+) const {
+    sw.writeInt3(hiddenSize);
+
+    sw.write(alpha);
+
+    sw.writeBuffer(hiddenActivations);
+
+    sw.writeBuffer(hiddenCs);
+
+    sw.write(static_cast<int>(visibleLayers.size()));
+
+    for (int vli = 0; vli < visibleLayers.size(); vli++) {
+        const VisibleLayer &vl = visibleLayers[vli];
+        const VisibleLayerDesc &vld = visibleLayerDescs[vli];
+
+        sw.writeInt3(vld.size);
+        sw.write(vld.radius);
+
+        writeLocalRFSMToSection(sw, vl.weights);
+
+        sw.writeBuffer(vl.inputCsPrev);
+    }
+}
+
+void Predictor::readFromSection(
+    SectionReader &sr
+) {
+    hiddenPartition = KernelPartition();
+
+    hiddenSize = sr.readSize();
+
+    int numHiddenColumns = hiddenSize.x * hiddenSize.y;
+
+    alpha = sr.read<float>();
+
+    sr.readBuffer(hiddenActivations);
+
+    sr.readBuffer(hiddenCs);
+
+    // Each visible layer takes at least its size and radius
+    int numVisibleLayers = sr.readCount(4 * sizeof(int));
+
+    if (hiddenActivations.size() != numHiddenColumns * hiddenSize.z || hiddenCs.size() != numHiddenColumns)
+        sr.fail();
+
+    if (sr.getFailed())
+        return;
+
+    visibleLayers.resize(numVisibleLayers);
+    visibleLayerDescs.resize(numVisibleLayers);
+
+    for (int vli = 0; vli < visibleLayers.size(); vli++) {
+        VisibleLayer &vl = visibleLayers[vli];
+        VisibleLayerDesc &vld = visibleLayerDescs[vli];
+
+        vld.size = sr.readSize();
+        vld.radius = sr.read<int>();
+
+        if (sr.getFailed())
+            return;
+
+        readLocalRFSMFromSection(sr, vld.size, hiddenSize, vld.radius, vl.weights);
+
+        sr.readBuffer(vl.inputCsPrev);
+
+        if (vl.inputCsPrev.size() != vld.size.x * vld.size.y)
+            sr.fail();
+
+        if (sr.getFailed())
+            return;
+    }
+}
+
+MemoryUsage Predictor::memoryUsage() const {
+    MemoryUsage usage;
+
+    for (int vli = 0; vli < visibleLayers.size(); vli++) {
+        const VisibleLayer &vl = visibleLayers[vli];
+
+        usage += vl.weights.memoryUsage();
+
+        usage.states += vectorMemory(vl.inputCsPrev);
+    }
+
+    usage.states += vectorMemory(hiddenActivations) + vectorMemory(hiddenCs);
+
+    usage.other += vectorMemory(hiddenPartition.starts);
+
+    return usage;
+}
+
+MemoryUsage Predictor::estimateMemoryUsage(
+    const Int3 &hiddenSize,
+    const std::vector<VisibleLayerDesc> &visibleLayerDescs
+) {
+    MemoryUsage usage;
+
+    for (int vli = 0; vli < visibleLayerDescs.size(); vli++) {
+        const VisibleLayerDesc &vld = visibleLayerDescs[vli];
+
+        usage += estimateSMLocalRF(vld.size, hiddenSize, vld.radius, false);
+
+        usage.states += static_cast<long long>(vld.size.x) * vld.size.y * sizeof(int);
+    }
+
+    long long numHiddenColumns = static_cast<long long>(hiddenSize.x) * hiddenSize.y;
+
+    usage.states += numHiddenColumns * hiddenSize.z * sizeof(float) + numHiddenColumns * sizeof(int);
+
+    return usage;
+}
@@ -9,6 +9,7 @@
 #pragma once
 
 #include "ComputeSystem.h"
+#include "ModelFile.h"
 
 namespace ogmaneo {
 // A prediction layer (predicts x_(t+1))
@@ -46,13 +47,23 @@ private:
     std::vector<VisibleLayer> visibleLayers;
     std::vector<VisibleLayerDesc> visibleLayerDescs;
 
+    // Cost-balanced split of hidden columns, used if ComputeSystem::costBalanced
+    KernelPartition hiddenPartition;
+
+    // Shape of a kernel over the hidden columns, for batch size lookup
+    KernelShape getHiddenShape(
+        KernelClass kernelClass
+    ) const;
+
     // --- Kernels ---
 
     void forward(
         const Int2 &pos,
         std::mt19937 &rng,
-        const std::vector<const IntBuffer*> &inputCs
-    );
+        const std::vector<const IntBuffer*> &inputCs,
+        IntBuffer* hiddenCsOut,
+        FloatBuffer* hiddenActivationsOut
+    ) const;
 
     void learn(
         const Int2 &pos,
@@ -63,10 +74,12 @@ private:
     static void forwardKernel(
         const Int2 &pos,
         std::mt19937 &rng,
-        Predictor* p,
-        const std::vector<const IntBuffer*> &inputCs
+        const Predictor* p,
+        const std::vector<const IntBuffer*> &inputCs,
+        IntBuffer* hiddenCsOut,
+        FloatBuffer* hiddenActivationsOut
     ) {
-        p->forward(pos, rng, inputCs);
+        p->forward(pos, rng, inputCs, hiddenCsOut, hiddenActivationsOut);
     }
 
     static void learnKernel(
@@ -100,6 +113,14 @@ public:
         const std::vector<const IntBuffer*> &inputCs // Hidden/output/prediction size
     );
 
+    // Predict into external state (prevs are not updated), only reads the layer so several may run at once (e.g. rollouts)
+    void activate(
+        ComputeSystem &cs, // Compute system
+        const std::vector<const IntBuffer*> &inputCs, // Hidden/output/prediction size
+        IntBuffer* hiddenCsOut, // Predictions to write, same size as getHiddenCs
+        FloatBuffer* hiddenActivationsOut // Activations to write (scratch), one per hidden cell
+    ) const;
+
     // Learning predictions (update weights)
     void learn(
         ComputeSystem &cs,
@@ -113,7 +134,18 @@ public:
 
     // Read from stream
     void readFromStream(
-        std::istream &is // Stream to read from
+        std::istream &is, // Stream to read from
+        TopologyCache* topologyCache = nullptr // Optional cache to take weight topologies from instead of the stream
+    );
+
+    // Write to a model file section
+    void writeToSection(
+        SectionWriter &sw // Section to write to
+    ) const;
+
+    // Read from a model file section
+    void readFromSection(
+        SectionReader &sr // Section to read from
     );
 
     // Get number of visible layers
@@ -135,6 +167,23 @@ public:
         return visibleLayerDescs[i];
     }
 
+    // Append all weight matrices (e.g. for dirty tracking)
+    void getWeightMatrices(
+        std::vector<SparseMatrix*> &mats
+    ) {
+        for (int vli = 0; vli < visibleLayers.size(); vli++)
+            mats.push_back(&visibleLayers[vli].weights);
+    }
+
+    // Memory held by weights, states and kernel partitions
+    MemoryUsage memoryUsage() const;
+
+    // Memory initRandom will allocate for these arguments
+    static MemoryUsage estimateMemoryUsage(
+        const Int3 &hiddenSize, // Hidden/output/prediction size
+        const std::vector<VisibleLayerDesc> &visibleLayerDescs // Descriptors for visible layers
+    );
+
     // Get the hidden activations (predictions)
     const IntBuffer &getHiddenCs() const {
         return hiddenCs;
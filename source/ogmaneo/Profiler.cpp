@@ -0,0 +1,160 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#include "Profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <string>
+
+using namespace ogmaneo;
+
+void Profiler::addKernel(
+    const KernelShape &shape,
+    long long elements,
+    double seconds
+) {
+    KernelKey key{ shape.kernelClass, shape.size.x, shape.size.y, shape.size.z, shape.radius };
+
+    // Each weight is a value and a column index
+    long long bytes = elements * std::max(1, shape.weightsPerColumn) * static_cast<long long>(sizeof(float) + sizeof(int));
+
+    #pragma omp critical (ogmaneoProfiler)
+    {
+        ProfileStats &stats = kernels[key];
+
+        stats.calls++;
+        stats.elements += elements;
+        stats.bytes += bytes;
+        stats.seconds += seconds;
+    }
+}
+
+void Profiler::addLayer(
+    int layer,
+    LayerStage stage,
+    int index,
+    double seconds
+) {
+    LayerKey key{ layer, stage, index };
+
+    #pragma omp critical (ogmaneoProfiler)
+    {
+        ProfileStats &stats = layers[key];
+
+        stats.calls++;
+        stats.seconds += seconds;
+    }
+}
+
+void Profiler::getReport(
+    ProfileReport &report
+) const {
+    report.kernels.clear();
+    report.layers.clear();
+
+    for (std::map<KernelKey, ProfileStats>::const_iterator it = kernels.begin(); it != kernels.end(); it++) {
+        KernelProfile kp;
+        kp.kernelClass = static_cast<KernelClass>(it->first[0]);
+        kp.size = Int3(it->first[1], it->first[2], it->first[3]);
+        kp.radius = it->first[4];
+        kp.stats = it->second;
+
+        report.kernels.push_back(kp);
+    }
+
+    for (std::map<LayerKey, ProfileStats>::const_iterator it = layers.begin(); it != layers.end(); it++) {
+        LayerProfile lp;
+        lp.layer = it->first[0];
+        lp.stage = static_cast<LayerStage>(it->first[1]);
+        lp.index = it->first[2];
+        lp.stats = it->second;
+
+        report.layers.push_back(lp);
+    }
+
+    std::stable_sort(report.kernels.begin(), report.kernels.end(), [](const KernelProfile &a, const KernelProfile &b) {
+        return a.stats.seconds > b.stats.seconds;
+    });
+
+    std::stable_sort(report.layers.begin(), report.layers.end(), [](const LayerProfile &a, const LayerProfile &b) {
+        return a.stats.seconds > b.stats.seconds;
+    });
+}
+
+void Profiler::writeReport(
+    std::ostream &os
+) const {
+    ProfileReport report;
+
+    getReport(report);
+
+    os << std::fixed << std::setprecision(3);
+
+    os << "kernel           size            radius     calls    elements         MB        ms\n";
+
+    for (int i = 0; i < report.kernels.size(); i++) {
+        const KernelProfile &kp = report.kernels[i];
+
+        os << std::left << std::setw(17) << kernelClassName(kp.kernelClass)
+            << std::setw(16) << (std::to_string(kp.size.x) + "x" + std::to_string(kp.size.y) + "x" + std::to_string(kp.size.z))
+            << std::right << std::setw(6) << kp.radius
+            << std::setw(10) << kp.stats.calls
+            << std::setw(12) << kp.stats.elements
+            << std::setw(11) << kp.stats.bytes / (1024.0 * 1024.0)
+            << std::setw(10) << kp.stats.seconds * 1000.0 << "\n";
+    }
+
+    os << "\nlayer  stage        index     calls        ms\n";
+
+    for (int i = 0; i < report.layers.size(); i++) {
+        const LayerProfile &lp = report.layers[i];
+
+        os << std::left << std::setw(7) << lp.layer
+            << std::setw(13) << layerStageName(lp.stage)
+            << std::right << std::setw(5) << lp.index
+            << std::setw(10) << lp.stats.calls
+            << std::setw(10) << lp.stats.seconds * 1000.0 << "\n";
+    }
+}
+
+const char* ogmaneo::kernelClassName(
+    KernelClass kernelClass
+) {
+    switch (kernelClass) {
+    case kernelSCForward:
+        return "scForward";
+    case kernelSCLearn:
+        return "scLearn";
+    case kernelPForward:
+        return "pForward";
+    case kernelPLearn:
+        return "pLearn";
+    case kernelAForward:
+        return "aForward";
+    case kernelALearn:
+        return "aLearn";
+    case kernelCopy:
+        return "copy";
+    default:
+        return "other";
+    }
+}
+
+const char* ogmaneo::layerStageName(
+    LayerStage stage
+) {
+    switch (stage) {
+    case stageSC:
+        return "sparseCoder";
+    case stagePredictor:
+        return "predictor";
+    default:
+        return "actor";
+    }
+}
@@ -0,0 +1,116 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#pragma once
+
+#include "Helpers.h"
+
+#include <map>
+#include <array>
+
+namespace ogmaneo {
+// Layer stages timed by Hierarchy
+enum LayerStage {
+    stageSC = 0, // Sparse coder step (or activation/learning alone)
+    stagePredictor = 1, // Predictor learning and activation
+    stageActor = 2 // Actor step (or learning alone)
+};
+
+// Accumulated counters of a kernel or layer stage
+struct ProfileStats {
+    long long calls; // Number of launches/updates
+    long long elements; // Columns processed (kernels only)
+    long long bytes; // Estimated bytes touched (kernels only)
+    double seconds; // Wall time
+
+    ProfileStats()
+    :
+    calls(0),
+    elements(0),
+    bytes(0),
+    seconds(0.0)
+    {}
+};
+
+// Kernel entry of a report, one per kernel class and shape
+struct KernelProfile {
+    KernelClass kernelClass;
+    Int3 size;
+    int radius;
+
+    ProfileStats stats;
+};
+
+// Layer entry of a report
+struct LayerProfile {
+    int layer; // Hierarchy layer index
+    LayerStage stage;
+    int index; // Predictor/actor index within the layer, 0 for the sparse coder
+
+    ProfileStats stats;
+};
+
+// Structured profile, entries sorted by wall time (most expensive first)
+struct ProfileReport {
+    std::vector<KernelProfile> kernels;
+    std::vector<LayerProfile> layers;
+};
+
+// Collects per-kernel and per-layer timings. Enabled by pointing ComputeSystem::profiler at one
+class Profiler {
+public:
+    typedef std::array<int, 5> KernelKey; // kernelClass, size, radius
+    typedef std::array<int, 3> LayerKey; // layer, stage, index
+
+private:
+    std::map<KernelKey, ProfileStats> kernels;
+    std::map<LayerKey, ProfileStats> layers;
+
+public:
+    // Record a kernel launch. Safe to call from multiple OpenMP threads
+    void addKernel(
+        const KernelShape &shape, // Launch shape
+        long long elements, // Columns processed
+        double seconds // Wall time
+    );
+
+    // Record a layer stage. Safe to call from multiple OpenMP threads
+    void addLayer(
+        int layer, // Hierarchy layer index
+        LayerStage stage, // Stage
+        int index, // Predictor/actor index within the layer
+        double seconds // Wall time
+    );
+
+    // Remove all records
+    void clear() {
+        kernels.clear();
+        layers.clear();
+    }
+
+    // Get the report
+    void getReport(
+        ProfileReport &report // Report to fill
+    ) const;
+
+    // Write the report as a human readable table
+    void writeReport(
+        std::ostream &os // Stream to write to
+    ) const;
+};
+
+// Name of a kernel class
+const char* kernelClassName(
+    KernelClass kernelClass
+);
+
+// Name of a layer stage
+const char* layerStageName(
+    LayerStage stage
+);
+} // namespace ogmaneo
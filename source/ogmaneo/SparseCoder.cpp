@@ -13,8 +13,9 @@ using namespace ogmaneo;
 void SparseCoder::forward(
     const Int2 &pos,
     std::mt19937 &rng,
-    const std::vector<const IntBuffer*> &inputCs
-) {
+    const std::vector<const IntBuffer*> &inputCs,
+    IntBuffer* hiddenCsOut
+) const {
     int hiddenColumnIndex = address2(pos, Int2(hiddenSize.x, hiddenSize.y));
 
     int maxIndex = 0;
@@ -27,7 +28,7 @@ void SparseCoder::forward(
 
         // For each visible layer
         for (int vli = 0; vli < visibleLayers.size(); vli++) {
-            VisibleLayer &vl = visibleLayers[vli];
+            const VisibleLayer &vl = visibleLayers[vli];
             const VisibleLayerDesc &vld = visibleLayerDescs[vli];
 
             sum += vl.weights.multiplyOHVs(*inputCs[vli], hiddenIndex, vld.size.z);
@@ -39,7 +40,7 @@ void SparseCoder::forward(
         }
     }
 
-    hiddenCs[hiddenColumnIndex] = maxIndex;
+    (*hiddenCsOut)[hiddenColumnIndex] = maxIndex;
 }
 
 void SparseCoder::learn(
@@ -82,11 +83,29 @@ void SparseCoder::learn(
     }
 }
 
+KernelShape SparseCoder::getHiddenShape(
+    KernelClass kernelClass
+) const {
+    int numHiddenColumns = hiddenSize.x * hiddenSize.y;
+
+    int radius = 0;
+    int numWeights = 0;
+
+    for (int vli = 0; vli < visibleLayers.size(); vli++) {
+        radius = std::max(radius, visibleLayerDescs[vli].radius);
+        numWeights += visibleLayers[vli].weights.nonZeroValues.size();
+    }
+
+    return KernelShape(kernelClass, hiddenSize, radius, numWeights / numHiddenColumns);
+}
+
 void SparseCoder::initRandom(
     ComputeSystem &cs,
     const Int3 &hiddenSize,
     const std::vector<VisibleLayerDesc> &visibleLayerDescs
 ) {
+    hiddenPartition = KernelPartition();
+
     this->visibleLayerDescs = visibleLayerDescs;
 
     this->hiddenSize = hiddenSize;
@@ -97,8 +116,6 @@ void SparseCoder::initRandom(
     int numHiddenColumns = hiddenSize.x * hiddenSize.y;
     int numHidden = numHiddenColumns * hiddenSize.z;
 
-    std::uniform_real_distribution<float> weightDist(-1.0f, 0.0f);
-
     // Create layers
     for (int vli = 0; vli < visibleLayers.size(); vli++) {
         VisibleLayer &vl = visibleLayers[vli];
@@ -108,13 +125,10 @@ void SparseCoder::initRandom(
         int numVisible = numVisibleColumns * vld.size.z;
 
         // Create weight matrix for this visible layer and initialize randomly
-        initSMLocalRF(vld.size, hiddenSize, vld.radius, vl.weights);
-
-        for (int i = 0; i < vl.weights.nonZeroValues.size(); i++)
-            vl.weights.nonZeroValues[i] = weightDist(cs.rng);
+        // Transpose is needed for reconstruction
+        initSMLocalRF(cs, vld.size, hiddenSize, vld.radius, true, vl.weights);
 
-        // Generate transpose (needed for reconstruction)
-        vl.weights.initT();
+        initSMUniform(cs.rng, -1.0f, 0.0f, vl.weights);
 
         vl.reconstructions = FloatBuffer(numVisible, 0.0f);
     }
@@ -129,21 +143,52 @@ void SparseCoder::step(
     const std::vector<const IntBuffer*> &inputCs,
     bool learnEnabled
 ) {
-    int numHiddenColumns = hiddenSize.x * hiddenSize.y;
+    activate(cs, inputCs);
 
-    runKernel2(cs, std::bind(SparseCoder::forwardKernel, std::placeholders::_1, std::placeholders::_2, this, inputCs), Int2(hiddenSize.x, hiddenSize.y), cs.rng, cs.batchSize2);
+    if (learnEnabled)
+        learn(cs, inputCs);
 
-    if (learnEnabled) {
-        for (int vli = 0; vli < visibleLayers.size(); vli++) {
-            VisibleLayer &vl = visibleLayers[vli];
-            VisibleLayerDesc &vld = visibleLayerDescs[vli];
+    updatePrevs(cs);
+}
 
-            runKernel2(cs, std::bind(SparseCoder::learnKernel, std::placeholders::_1, std::placeholders::_2, this, inputCs[vli], vli), Int2(vld.size.x, vld.size.y), cs.rng, cs.batchSize2);
-        }
+void SparseCoder::activate(
+    ComputeSystem &cs,
+    const std::vector<const IntBuffer*> &inputCs
+) {
+    runKernel2(cs, std::bind(SparseCoder::forwardKernel, std::placeholders::_1, std::placeholders::_2, this, inputCs, &hiddenCs), Int2(hiddenSize.x, hiddenSize.y), cs.rng, getHiddenShape(kernelSCForward), getHiddenPartition(cs, *this, hiddenPartition));
+}
+
+void SparseCoder::activate(
+    ComputeSystem &cs,
+    const std::vector<const IntBuffer*> &inputCs,
+    IntBuffer* hiddenCsOut
+) const {
+    // No cost-balanced partition, it is cached in the layer
+    runKernel2(cs, std::bind(SparseCoder::forwardKernel, std::placeholders::_1, std::placeholders::_2, this, inputCs, hiddenCsOut), Int2(hiddenSize.x, hiddenSize.y), cs.rng, getHiddenShape(kernelSCForward), nullptr);
+}
+
+void SparseCoder::learn(
+    ComputeSystem &cs,
+    const std::vector<const IntBuffer*> &inputCs
+) {
+    for (int vli = 0; vli < visibleLayers.size(); vli++) {
+        VisibleLayer &vl = visibleLayers[vli];
+        VisibleLayerDesc &vld = visibleLayerDescs[vli];
+
+        int numVisibleColumns = vld.size.x * vld.size.y;
+
+        KernelShape shape(kernelSCLearn, vld.size, vld.radius, vl.weights.nonZeroValues.size() / numVisibleColumns);
+
+        runKernel2(cs, std::bind(SparseCoder::learnKernel, std::placeholders::_1, std::placeholders::_2, this, inputCs[vli], vli), Int2(vld.size.x, vld.size.y), cs.rng, shape);
     }
+}
+
+void SparseCoder::updatePrevs(
+    ComputeSystem &cs
+) {
+    int numHiddenColumns = hiddenSize.x * hiddenSize.y;
 
-    // Update prevs
-    runKernel1(cs, std::bind(copyInt, std::placeholders::_1, std::placeholders::_2, &hiddenCs, &hiddenCsPrev), numHiddenColumns, cs.rng, cs.batchSize1);
+    runKernel1(cs, std::bind(copyInt, std::placeholders::_1, std::placeholders::_2, &hiddenCs, &hiddenCsPrev), numHiddenColumns, cs.rng, copyShape(numHiddenColumns));
 }
 
 void SparseCoder::writeToStream(
@@ -171,8 +216,11 @@ void SparseCoder::writeToStream(
 }
 
 void SparseCoder::readFromStream(
-    std::istream &is
+    std::istream &is,
+    TopologyCache* topologyCache
 ) {
+    hiddenPartition = KernelPartition();
+
     is.read(reinterpret_cast<char*>(&hiddenSize), sizeof(Int3));
 
     is.read(reinterpret_cast<char*>(&alpha), sizeof(float));
@@ -196,8 +244,112 @@ void SparseCoder::readFromStream(
         int numVisibleColumns = vld.size.x * vld.size.y;
         int numVisible = numVisibleColumns * vld.size.z;
 
-        readSMFromStream(is, vl.weights);
+        readLocalRFSMFromStream(is, vld.size, hiddenSize, vld.radius, topologyCache, vl.weights);
+
+        vl.reconstructions = FloatBuffer(numVisible, 0.0f);
+    }
+}
+
+void SparseCoder::writeToSection(
+    SectionWriter &sw
+) const {
+    sw.writeInt3(hiddenSize);
+
+    sw.write(alpha);
+
+    sw.writeBuffer(hiddenCs);
+    sw.writeBuffer(hiddenCsPrev);
+
+    sw.write(static_cast<int>(visibleLayers.size()));
+
+    for (int vli = 0; vli < visibleLayers.size(); vli++) {
+        const VisibleLayer &vl = visibleLayers[vli];
+        const VisibleLayerDesc &vld = visibleLayerDescs[vli];
+
+        sw.writeInt3(vld.size);
+        sw.write(vld.radius);
+
+        writeLocalRFSMToSection(sw, vl.weights);
+    }
+}
+
+void SparseCoder::readFromSection(
+    SectionReader &sr
+) {
+    hiddenPartition = KernelPartition();
+
+    hiddenSize = sr.readSize();
+
+    int numHiddenColumns = hiddenSize.x * hiddenSize.y;
+
+    alpha = sr.read<float>();
+
+    sr.readBuffer(hiddenCs);
+    sr.readBuffer(hiddenCsPrev);
+
+    // Each visible layer takes at least its size and radius
+    int numVisibleLayers = sr.readCount(4 * sizeof(int));
+
+    if (hiddenCs.size() != numHiddenColumns || hiddenCsPrev.size() != numHiddenColumns)
+        sr.fail();
+
+    if (sr.getFailed())
+        return;
+
+    visibleLayers.resize(numVisibleLayers);
+    visibleLayerDescs.resize(numVisibleLayers);
+
+    for (int vli = 0; vli < visibleLayers.size(); vli++) {
+        VisibleLayer &vl = visibleLayers[vli];
+        VisibleLayerDesc &vld = visibleLayerDescs[vli];
+
+        vld.size = sr.readSize();
+        vld.radius = sr.read<int>();
+
+        if (sr.getFailed())
+            return;
+
+        int numVisible = vld.size.x * vld.size.y * vld.size.z;
+
+        readLocalRFSMFromSection(sr, vld.size, hiddenSize, vld.radius, vl.weights);
 
         vl.reconstructions = FloatBuffer(numVisible, 0.0f);
     }
-}
\ No newline at end of file
+}
+
+MemoryUsage SparseCoder::memoryUsage() const {
+    MemoryUsage usage;
+
+    for (int vli = 0; vli < visibleLayers.size(); vli++) {
+        const VisibleLayer &vl = visibleLayers[vli];
+
+        usage += vl.weights.memoryUsage();
+
+        usage.states += vectorMemory(vl.reconstructions);
+    }
+
+    usage.states += vectorMemory(hiddenCs) + vectorMemory(hiddenCsPrev);
+
+    usage.other += vectorMemory(hiddenPartition.starts);
+
+    return usage;
+}
+
+MemoryUsage SparseCoder::estimateMemoryUsage(
+    const Int3 &hiddenSize,
+    const std::vector<VisibleLayerDesc> &visibleLayerDescs
+) {
+    MemoryUsage usage;
+
+    for (int vli = 0; vli < visibleLayerDescs.size(); vli++) {
+        const VisibleLayerDesc &vld = visibleLayerDescs[vli];
+
+        usage += estimateSMLocalRF(vld.size, hiddenSize, vld.radius, true);
+
+        usage.states += static_cast<long long>(vld.size.x) * vld.size.y * vld.size.z * sizeof(float);
+    }
+
+    usage.states += static_cast<long long>(hiddenSize.x) * hiddenSize.y * 2 * sizeof(int);
+
+    return usage;
+}
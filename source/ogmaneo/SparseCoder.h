@@ -9,6 +9,7 @@
 #pragma once
 
 #include "ComputeSystem.h"
+#include "ModelFile.h"
 
 namespace ogmaneo {
 // Sparse coder
@@ -44,14 +45,23 @@ private:
     // Visible layers and associated descriptors
     std::vector<VisibleLayer> visibleLayers;
     std::vector<VisibleLayerDesc> visibleLayerDescs;
-    
+
+    // Cost-balanced split of hidden columns, used if ComputeSystem::costBalanced
+    KernelPartition hiddenPartition;
+
+    // Shape of a kernel over the hidden columns, for batch size lookup
+    KernelShape getHiddenShape(
+        KernelClass kernelClass
+    ) const;
+
     // --- Kernels ---
     
     void forward(
         const Int2 &pos,
         std::mt19937 &rng,
-        const std::vector<const IntBuffer*> &inputCs
-    );
+        const std::vector<const IntBuffer*> &inputCs,
+        IntBuffer* hiddenCsOut
+    ) const;
 
     void learn(
         const Int2 &pos,
@@ -63,10 +73,11 @@ private:
     static void forwardKernel(
         const Int2 &pos,
         std::mt19937 &rng,
-        SparseCoder* sc,
-        const std::vector<const IntBuffer*> &inputCs
+        const SparseCoder* sc,
+        const std::vector<const IntBuffer*> &inputCs,
+        IntBuffer* hiddenCsOut
     ) {
-        sc->forward(pos, rng, inputCs);
+        sc->forward(pos, rng, inputCs, hiddenCsOut);
     }
 
     static void learnKernel(
@@ -102,6 +113,30 @@ public:
         bool learnEnabled // Whether to learn
     );
 
+    // Sparse coding only, a step split into activate, (optionally) learn and updatePrevs
+    void activate(
+        ComputeSystem &cs, // Compute system
+        const std::vector<const IntBuffer*> &inputCs // Input states
+    );
+
+    // Sparse coding into external state, only reads the layer so several may run at once (e.g. rollouts)
+    void activate(
+        ComputeSystem &cs, // Compute system
+        const std::vector<const IntBuffer*> &inputCs, // Input states
+        IntBuffer* hiddenCsOut // Hidden states to write, same size as getHiddenCs
+    ) const;
+
+    // Learn from the last activation, must come before updatePrevs
+    void learn(
+        ComputeSystem &cs, // Compute system
+        const std::vector<const IntBuffer*> &inputCs // Input states used in the last activation
+    );
+
+    // Remember the current hidden states as previous
+    void updatePrevs(
+        ComputeSystem &cs // Compute system
+    );
+
     // Write to stream
     void writeToStream(
         std::ostream &os // Stream to write to
@@ -109,7 +144,18 @@ public:
 
     // Read from stream
     void readFromStream(
-        std::istream &is // Stream to read from
+        std::istream &is, // Stream to read from
+        TopologyCache* topologyCache = nullptr // Optional cache to take weight topologies from instead of the stream
+    );
+
+    // Write to a model file section
+    void writeToSection(
+        SectionWriter &sw // Section to write to
+    ) const;
+
+    // Read from a model file section
+    void readFromSection(
+        SectionReader &sr // Section to read from
     );
 
     // Get the number of visible layers
@@ -131,6 +177,23 @@ public:
         return visibleLayerDescs[i];
     }
 
+    // Append all weight matrices (e.g. for dirty tracking)
+    void getWeightMatrices(
+        std::vector<SparseMatrix*> &mats
+    ) {
+        for (int vli = 0; vli < visibleLayers.size(); vli++)
+            mats.push_back(&visibleLayers[vli].weights);
+    }
+
+    // Memory held by weights, states and kernel partitions
+    MemoryUsage memoryUsage() const;
+
+    // Memory initRandom will allocate for these arguments
+    static MemoryUsage estimateMemoryUsage(
+        const Int3 &hiddenSize, // Hidden/output size
+        const std::vector<VisibleLayerDesc> &visibleLayerDescs // Descriptors for visible layers
+    );
+
     // Get the hidden states
     const IntBuffer &getHiddenCs() const {
         return hiddenCs;
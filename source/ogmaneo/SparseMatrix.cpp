@@ -8,6 +8,9 @@
 
 #include "SparseMatrix.h"
 
+#include <algorithm>
+#include <omp.h>
+
 using namespace ogmaneo;
 
 void SparseMatrix::init(
@@ -56,24 +59,99 @@ void SparseMatrix::init(
 	}
 }
 
+void SparseMatrix::initDirty(
+	int blockSize
+) {
+	dirtyBlockShift = 0;
+
+	while ((1 << dirtyBlockShift) < blockSize)
+		dirtyBlockShift++;
+
+	int numBlocks = (nonZeroValues.size() + (1 << dirtyBlockShift) - 1) >> dirtyBlockShift;
+
+	dirtyBlocks = std::vector<DirtyFlag>(std::max(1, numBlocks));
+}
+
+MemoryUsage SparseMatrix::memoryUsage() const {
+	MemoryUsage usage;
+
+	usage.weights = vectorMemory(nonZeroValues);
+	usage.topology = vectorMemory(rowRanges) + vectorMemory(columnIndices);
+	usage.transpose = vectorMemory(nonZeroValueIndices) + vectorMemory(columnRanges) + vectorMemory(rowIndices);
+	usage.other = vectorMemory(dirtyBlocks);
+
+	return usage;
+}
+
+MemoryUsage SparseMatrix::estimateMemoryUsage(
+	int rows,
+	int columns,
+	long long nonZeros,
+	bool transpose
+) {
+	MemoryUsage usage;
+
+	usage.weights = nonZeros * sizeof(float);
+	usage.topology = (rows + 1 + nonZeros) * sizeof(int);
+
+	if (transpose)
+		usage.transpose = (nonZeros * 2 + columns + 1) * sizeof(int);
+
+	return usage;
+}
+
+// First row of block b when splitting rows into numBlocks contiguous blocks
+static int blockRow(
+	int rows,
+	int b,
+	int numBlocks
+) {
+	return static_cast<long long>(rows) * b / numBlocks;
+}
+
 void SparseMatrix::initT() {
-	columnRanges.resize(columns + 1, 0);
+	int numNonZeros = nonZeroValues.size();
+
+	columnRanges = std::vector<int>(columns + 1, 0);
+
+	rowIndices.resize(numNonZeros);
+
+	nonZeroValueIndices.resize(numNonZeros);
+
+	// Parallel counting sort over contiguous row blocks, one per thread.
+	// Histograms take numBlocks * columns ints, so blocks are limited to keep that within the number of nonzeros
+	int numBlocks = std::max(1, std::min(omp_get_max_threads(), numNonZeros / std::max(1, columns)));
+
+	std::vector<int> blockOffsets(static_cast<size_t>(numBlocks) * columns, 0); // [block][column]
+
+	// Count nonzeros per column in each block
+	#pragma omp parallel for num_threads(numBlocks)
+	for (int b = 0; b < numBlocks; b++) {
+		int* counts = &blockOffsets[static_cast<size_t>(b) * columns];
+
+		for (int j = rowRanges[blockRow(rows, b, numBlocks)]; j < rowRanges[blockRow(rows, b + 1, numBlocks)]; j++)
+			counts[columnIndices[j]]++;
+	}
+
+	// Turn counts into offsets within each column (blocks in row order), columnRanges temporarily holds column sizes
+	#pragma omp parallel for
+	for (int i = 0; i < columns; i++) {
+		int offset = 0;
 
-	rowIndices.resize(nonZeroValues.size());
+		for (int b = 0; b < numBlocks; b++) {
+			int &o = blockOffsets[static_cast<size_t>(b) * columns + i];
 
-	nonZeroValueIndices.resize(nonZeroValues.size());
+			int temp = o;
 
-	// Pattern for T
-	int nextIndex;
+			o = offset;
 
-	for (int i = 0; i < rows; i = nextIndex) {
-		nextIndex = i + 1;
+			offset += temp;
+		}
 
-		for (int j = rowRanges[i]; j < rowRanges[nextIndex]; j++)
-			columnRanges[columnIndices[j]]++;
+		columnRanges[i] = offset;
 	}
 
-	// Bring row range array in place using exclusive scan
+	// Bring column range array in place using exclusive scan
 	int offset = 0;
 
 	for (int i = 0; i < columns; i++) {
@@ -86,21 +164,21 @@ void SparseMatrix::initT() {
 
 	columnRanges[columns] = offset;
 
-	std::vector<int> columnOffsets = columnRanges;
-
-	for (int i = 0; i < rows; i = nextIndex) {
-		nextIndex = i + 1;
+	// Scatter without contention, rows stay in ascending order within each column
+	#pragma omp parallel for num_threads(numBlocks)
+	for (int b = 0; b < numBlocks; b++) {
+		int* offsets = &blockOffsets[static_cast<size_t>(b) * columns];
 
-		for (int j = rowRanges[i]; j < rowRanges[nextIndex]; j++) {
-			int colIndex = columnIndices[j];
+		for (int i = blockRow(rows, b, numBlocks); i < blockRow(rows, b + 1, numBlocks); i++) {
+			for (int j = rowRanges[i]; j < rowRanges[i + 1]; j++) {
+				int column = columnIndices[j];
 
-			int nonZeroIndexT = columnOffsets[colIndex];
+				int nonZeroIndexT = columnRanges[column] + offsets[column]++;
 
-			rowIndices[nonZeroIndexT] = i;
+				rowIndices[nonZeroIndexT] = i;
 
-			nonZeroValueIndices[nonZeroIndexT] = j;
-
-			columnOffsets[colIndex]++;
+				nonZeroValueIndices[nonZeroIndexT] = j;
+			}
 		}
 	}
 }
@@ -138,7 +216,7 @@ float SparseMatrix::distance2(
 
 int SparseMatrix::count(
 	int row
-) {
+) const {
 	int nextIndex = row + 1;
 	
 	return rowRanges[nextIndex] - rowRanges[row];
@@ -163,6 +241,8 @@ void SparseMatrix::fill(
     float value
 ) {
 	int nextIndex = row + 1;
+
+	markDirty(rowRanges[row], rowRanges[nextIndex]);
 	
 	for (int j = rowRanges[row]; j < rowRanges[nextIndex]; j++)
 		nonZeroValues[j] = value;
@@ -240,8 +320,10 @@ void SparseMatrix::fillT(
 ) {
 	int nextIndex = column + 1;
 	
-	for (int j = columnRanges[column]; j < columnRanges[nextIndex]; j++)
+	for (int j = columnRanges[column]; j < columnRanges[nextIndex]; j++) {
+		markDirty(nonZeroValueIndices[j]);
 		nonZeroValues[nonZeroValueIndices[j]] = value;
+	}
 }
 
 float SparseMatrix::totalT(
@@ -261,7 +343,7 @@ float SparseMatrix::multiplyOHVs(
 	const std::vector<int> &nonZeroIndices,
 	int row,
 	int oneHotSize
-) {
+) const {
 	float sum = 0.0f;
 
 	int nextIndex = row + 1;
@@ -469,6 +551,8 @@ void SparseMatrix::deltas(
 	int row
 ) {
 	int nextIndex = row + 1;
+
+	markDirty(rowRanges[row], rowRanges[nextIndex]);
 	
 	for (int j = rowRanges[row]; j < rowRanges[nextIndex]; j++)
 		nonZeroValues[j] += delta * in[columnIndices[j]];
@@ -481,8 +565,10 @@ void SparseMatrix::deltasT(
 ) {
 	int nextIndex = column + 1;
 	
-	for (int j = columnRanges[column]; j < columnRanges[nextIndex]; j++)
+	for (int j = columnRanges[column]; j < columnRanges[nextIndex]; j++) {
+		markDirty(nonZeroValueIndices[j]);
 		nonZeroValues[nonZeroValueIndices[j]] += delta * in[rowIndices[j]];
+	}
 }
 
 void SparseMatrix::deltaOHVs(
@@ -493,6 +579,8 @@ void SparseMatrix::deltaOHVs(
 ) {
 	int nextIndex = row + 1;
 
+	markDirty(rowRanges[row], rowRanges[nextIndex]);
+
 	for (int jj = rowRanges[row]; jj < rowRanges[nextIndex]; jj += oneHotSize) {
 		int j = jj + nonZeroIndices[columnIndices[jj] / oneHotSize];
 
@@ -511,6 +599,8 @@ void SparseMatrix::deltaOHVsT(
 	for (int jj = columnRanges[column]; jj < columnRanges[nextIndex]; jj += oneHotSize) {
 		int j = jj + nonZeroIndices[rowIndices[jj] / oneHotSize];
 
+		markDirty(nonZeroValueIndices[j]);
+
 		nonZeroValues[nonZeroValueIndices[j]] += delta;
 	}
 }
@@ -524,6 +614,8 @@ void SparseMatrix::deltaOHVs(
 ) {
 	int nextIndex = row + 1;
 
+	markDirty(rowRanges[row], rowRanges[nextIndex]);
+
 	for (int jj = rowRanges[row]; jj < rowRanges[nextIndex]; jj += oneHotSize) {
 		int i = columnIndices[jj] / oneHotSize;
 		int j = jj + nonZeroIndices[i];
@@ -545,6 +637,8 @@ void SparseMatrix::deltaOHVsT(
 		int i = rowIndices[jj] / oneHotSize;
 		int j = jj + nonZeroIndices[i];
 
+		markDirty(nonZeroValueIndices[j]);
+
 		nonZeroValues[nonZeroValueIndices[j]] += delta * nonZeroScalars[i];
 	}
 }
@@ -558,6 +652,8 @@ void SparseMatrix::deltaChangedOHVs(
 ) {
 	int nextIndex = row + 1;
 
+	markDirty(rowRanges[row], rowRanges[nextIndex]);
+
 	for (int jj = rowRanges[row]; jj < rowRanges[nextIndex]; jj += oneHotSize) {
 		int i = columnIndices[jj] / oneHotSize;
 
@@ -584,6 +680,8 @@ void SparseMatrix::deltaChangedOHVsT(
 		if (nonZeroIndices[i] != nonZeroIndicesPrev[i]) {
 			int j = jj + nonZeroIndices[i];
 
+			markDirty(nonZeroValueIndices[j]);
+
 			nonZeroValues[nonZeroValueIndices[j]] += delta;
 		}
 	}
@@ -599,6 +697,8 @@ void SparseMatrix::deltaUsageOHVs(
 ) {
 	int nextIndex = row + 1;
 
+	markDirty(rowRanges[row], rowRanges[nextIndex]);
+
 	for (int jj = rowRanges[row]; jj < rowRanges[nextIndex]; jj += oneHotSize) {
 		int i = columnIndices[jj] / oneHotSize;
 
@@ -626,6 +726,8 @@ void SparseMatrix::deltaUsageOHVsT(
 		if (nonZeroIndices[i] != nonZeroIndicesPrev[i]) {
 			int j = jj + nonZeroIndices[i];
 
+			markDirty(nonZeroValueIndices[j]);
+
 			nonZeroValues[nonZeroValueIndices[j]] += delta * usages[rowIndices[j]];
 		}
 	}
@@ -639,6 +741,8 @@ void SparseMatrix::fillOHVs(
 ) {
 	int nextIndex = row + 1;
 
+	markDirty(rowRanges[row], rowRanges[nextIndex]);
+
 	for (int jj = rowRanges[row]; jj < rowRanges[nextIndex]; jj += oneHotSize) {
 		int j = jj + nonZeroIndices[columnIndices[jj] / oneHotSize];
 
@@ -657,6 +761,8 @@ void SparseMatrix::fillOHVsT(
 	for (int jj = columnRanges[column]; jj < columnRanges[nextIndex]; jj += oneHotSize) {
 		int j = jj + nonZeroIndices[rowIndices[jj] / oneHotSize];
 
+		markDirty(nonZeroValueIndices[j]);
+
 		nonZeroValues[nonZeroValueIndices[j]] = value;
 	}
 }
@@ -669,6 +775,9 @@ void SparseMatrix::deltaTracedOHVs(
 ) {
 	int nextIndex = row + 1;
 
+	markDirty(rowRanges[row], rowRanges[nextIndex]);
+	traces.markDirty(rowRanges[row], rowRanges[nextIndex]);
+
 	for (int j = rowRanges[row]; j < rowRanges[nextIndex]; j++) {
 		nonZeroValues[j] += delta * traces.nonZeroValues[j];
 		traces.nonZeroValues[j] *= traceDecay;
@@ -684,6 +793,9 @@ void SparseMatrix::deltaTracedOHVsT(
 	int nextIndex = column + 1;
 
 	for (int j = columnRanges[column]; j < columnRanges[nextIndex]; j++) {
+		markDirty(nonZeroValueIndices[j]);
+		traces.markDirty(nonZeroValueIndices[j]);
+
 		nonZeroValues[nonZeroValueIndices[j]] += delta * traces.nonZeroValues[nonZeroValueIndices[j]];
 		traces.nonZeroValues[nonZeroValueIndices[j]] *= traceDecay;
 	}
@@ -695,6 +807,8 @@ void SparseMatrix::hebb(
 	float alpha
 ) {
 	int nextIndex = row + 1;
+
+	markDirty(rowRanges[row], rowRanges[nextIndex]);
 	
 	for (int j = rowRanges[row]; j < rowRanges[nextIndex]; j++)
 		nonZeroValues[j] += alpha * (in[columnIndices[j]] - nonZeroValues[j]);
@@ -707,8 +821,10 @@ void SparseMatrix::hebbT(
 ) {
 	int nextIndex = column + 1;
 	
-	for (int j = columnRanges[column]; j < columnRanges[nextIndex]; j++)
+	for (int j = columnRanges[column]; j < columnRanges[nextIndex]; j++) {
+		markDirty(nonZeroValueIndices[j]);
 		nonZeroValues[nonZeroValueIndices[j]] += alpha * (in[rowIndices[j]] - nonZeroValues[nonZeroValueIndices[j]]);
+	}
 }
 
 void SparseMatrix::hebbOHVs(
@@ -718,6 +834,8 @@ void SparseMatrix::hebbOHVs(
 	float alpha
 ) {
 	int nextIndex = row + 1;
+
+	markDirty(rowRanges[row], rowRanges[nextIndex]);
 	
 	for (int jj = rowRanges[row]; jj < rowRanges[nextIndex]; jj += oneHotSize) {
 		int targetDJ = nonZeroIndices[columnIndices[jj] / oneHotSize];
@@ -748,6 +866,8 @@ void SparseMatrix::hebbOHVsT(
 
 			float target = (dj == targetDJ ? 1.0f : 0.0f);
 
+			markDirty(nonZeroValueIndices[j]);
+
 			nonZeroValues[nonZeroValueIndices[j]] += alpha * (target - nonZeroValues[nonZeroValueIndices[j]]);
 		}
 	}
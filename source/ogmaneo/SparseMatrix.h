@@ -8,11 +8,51 @@
 
 #pragma once
 
+#include "MemoryUsage.h"
+
 #include <vector>
+#include <algorithm>
+#include <atomic>
 #include <math.h>
 #include <assert.h>
 
 namespace ogmaneo {
+// Changed flag of a block of values. Kernels running in parallel may set the same flag, so it is atomic (relaxed, as it is
+// only read once the kernels are done). Copyable so matrices stay copyable
+struct DirtyFlag {
+	std::atomic<unsigned char> value;
+
+	DirtyFlag()
+	:
+	value(0)
+	{}
+
+	DirtyFlag(
+		const DirtyFlag &other
+	)
+	:
+	value(other.value.load(std::memory_order_relaxed))
+	{}
+
+	DirtyFlag &operator=(
+		const DirtyFlag &other
+	) {
+		value.store(other.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+		return *this;
+	}
+
+	void set() {
+		// Skip the store (and cache line invalidation) if already set
+		if (value.load(std::memory_order_relaxed) == 0)
+			value.store(1, std::memory_order_relaxed);
+	}
+
+	operator bool() const {
+		return value.load(std::memory_order_relaxed) != 0;
+	}
+};
+
 // Compressed sparse row (CSR) format
 struct SparseMatrix {
 	int rows, columns; // Dimensions
@@ -26,9 +66,16 @@ struct SparseMatrix {
 	std::vector<int> columnRanges;
 	std::vector<int> rowIndices;
 
+	// Dirty tracking of nonZeroValues, one flag per block. Disabled while empty
+	std::vector<DirtyFlag> dirtyBlocks;
+	int dirtyBlockShift; // Log2 of block size
+
 	// --- Init ---
 
-	SparseMatrix() {}
+	SparseMatrix()
+	:
+	dirtyBlockShift(10)
+	{}
 
 	// If you don't want to construct immediately
 	SparseMatrix(
@@ -37,7 +84,10 @@ struct SparseMatrix {
 		const std::vector<float> &nonZeroValues,
 		const std::vector<int> &rowRanges,
 		const std::vector<int> &columnIndices
-	) {
+	)
+	:
+	dirtyBlockShift(10)
+	{
 		init(rows, columns, nonZeroValues, rowRanges, columnIndices);
 	}
 
@@ -46,7 +96,10 @@ struct SparseMatrix {
 		int rows,
 		int columns,
 		const std::vector<float> &data
-	) {
+	)
+	:
+	dirtyBlockShift(10)
+	{
 		init(rows, columns, data);
 	}
 
@@ -69,6 +122,60 @@ struct SparseMatrix {
 	// Generate a transpose, must be called after the original has been created
 	void initT();
 
+	// --- Dirty Tracking ---
+
+	// Start tracking changed values in blocks of (at least) blockSize values, all blocks start clean
+	void initDirty(
+		int blockSize
+	);
+
+	// Stop tracking changes
+	void clearDirty() {
+		dirtyBlocks.clear();
+	}
+
+	// Mark all blocks clean (keeps tracking enabled)
+	void resetDirty() {
+		std::fill(dirtyBlocks.begin(), dirtyBlocks.end(), DirtyFlag());
+	}
+
+	int getDirtyBlockSize() const {
+		return 1 << dirtyBlockShift;
+	}
+
+	// Mark value range [begin, end) as changed
+	void markDirty(
+		int begin,
+		int end
+	) {
+		if (dirtyBlocks.empty() || begin >= end)
+			return;
+
+		for (int b = begin >> dirtyBlockShift; b <= (end - 1) >> dirtyBlockShift; b++)
+			dirtyBlocks[b].set();
+	}
+
+	// Mark a single value as changed
+	void markDirty(
+		int index
+	) {
+		if (!dirtyBlocks.empty())
+			dirtyBlocks[index >> dirtyBlockShift].set();
+	}
+
+	// --- Memory ---
+
+	// Bytes held by values (weights), row ranges and column indices (topology), transpose and dirty flags (other)
+	MemoryUsage memoryUsage() const;
+
+	// Bytes a matrix of this shape will hold, before dirty tracking
+	static MemoryUsage estimateMemoryUsage(
+		int rows,
+		int columns,
+		long long nonZeros,
+		bool transpose // Whether initT will be called
+	);
+
 	// --- Dense ---
 
 	float multiply(
@@ -83,7 +190,7 @@ struct SparseMatrix {
 
 	int count(
 		int row
-	);
+	) const;
 
 	float count(
 		const std::vector<float> &in,
@@ -133,7 +240,7 @@ struct SparseMatrix {
 		const std::vector<int> &nonZeroIndices,
 		int row,
 		int oneHotSize
-	);
+	) const;
 
 	float multiplyOHVsT(
 		const std::vector<int> &nonZeroIndices,
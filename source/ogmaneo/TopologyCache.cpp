@@ -0,0 +1,188 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#include "TopologyCache.h"
+
+#include "ComputeSystem.h"
+
+using namespace ogmaneo;
+
+void TopologyCache::initSMLocalRF(
+    const Int3 &inSize,
+    const Int3 &outSize,
+    int radius,
+    bool transpose,
+    SparseMatrix &mat
+) {
+    Key key{ inSize.x, inSize.y, inSize.z, outSize.x, outSize.y, outSize.z, radius };
+
+    const SparseMatrix* cached;
+
+    // Layers may be loaded in parallel. Entries are never removed or moved by insertion,
+    // and the transpose is only generated here, so copying can happen outside the critical section
+    #pragma omp critical (ogmaneoTopologyCache)
+    {
+        std::map<Key, SparseMatrix>::iterator it = topologies.find(key);
+
+        if (it == topologies.end()) {
+            SparseMatrix topology;
+
+            ogmaneo::initSMLocalRF(inSize, outSize, radius, topology);
+
+            topology.nonZeroValues.clear();
+            topology.nonZeroValues.shrink_to_fit();
+
+            it = topologies.insert(std::make_pair(key, std::move(topology))).first;
+        }
+
+        SparseMatrix &topology = it->second;
+
+        // Transpose is generated once, on first request
+        if (transpose && topology.columnRanges.empty()) {
+            // initT sizes by the number of values
+            topology.nonZeroValues.resize(topology.columnIndices.size());
+
+            topology.initT();
+
+            topology.nonZeroValues.clear();
+            topology.nonZeroValues.shrink_to_fit();
+        }
+
+        cached = &topology;
+    }
+
+    const SparseMatrix &topology = *cached;
+
+    mat.rows = topology.rows;
+    mat.columns = topology.columns;
+
+    mat.nonZeroValues = std::vector<float>(topology.columnIndices.size(), 0.0f);
+    mat.rowRanges = topology.rowRanges;
+    mat.columnIndices = topology.columnIndices;
+
+    if (transpose) {
+        mat.nonZeroValueIndices = topology.nonZeroValueIndices;
+        mat.columnRanges = topology.columnRanges;
+        mat.rowIndices = topology.rowIndices;
+    }
+    else {
+        mat.nonZeroValueIndices.clear();
+        mat.columnRanges.clear();
+        mat.rowIndices.clear();
+    }
+}
+
+void TopologyCache::writeToStream(
+    std::ostream &os
+) const {
+    int numTopologies = topologies.size();
+
+    os.write(reinterpret_cast<const char*>(&numTopologies), sizeof(int));
+
+    for (std::map<Key, SparseMatrix>::const_iterator it = topologies.begin(); it != topologies.end(); it++) {
+        os.write(reinterpret_cast<const char*>(it->first.data()), it->first.size() * sizeof(int));
+
+        writeSMToStream(os, it->second);
+    }
+}
+
+void TopologyCache::readFromStream(
+    std::istream &is
+) {
+    int numTopologies;
+
+    is.read(reinterpret_cast<char*>(&numTopologies), sizeof(int));
+
+    for (int i = 0; i < numTopologies; i++) {
+        Key key;
+
+        is.read(reinterpret_cast<char*>(key.data()), key.size() * sizeof(int));
+
+        readSMFromStream(is, topologies[key]);
+    }
+}
+
+void ogmaneo::initSMLocalRF(
+    ComputeSystem &cs,
+    const Int3 &inSize,
+    const Int3 &outSize,
+    int radius,
+    bool transpose,
+    SparseMatrix &mat
+) {
+    if (cs.topologyCache != nullptr)
+        cs.topologyCache->initSMLocalRF(inSize, outSize, radius, transpose, mat);
+    else {
+        initSMLocalRF(inSize, outSize, radius, mat);
+
+        if (transpose)
+            mat.initT();
+    }
+}
+
+// Skip a buffer written by writeBufferToStream, returns its number of elements
+static int skipIntBufferInStream(
+    std::istream &is
+) {
+    int size = 0;
+
+    is.read(reinterpret_cast<char*>(&size), sizeof(int));
+
+    is.ignore(static_cast<std::streamsize>(size) * sizeof(int));
+
+    return size;
+}
+
+void ogmaneo::readLocalRFSMFromStream(
+    std::istream &is,
+    const Int3 &inSize,
+    const Int3 &outSize,
+    int radius,
+    TopologyCache* topologyCache,
+    SparseMatrix &mat
+) {
+    if (topologyCache == nullptr) {
+        readSMFromStream(is, mat);
+
+        return;
+    }
+
+    int rows = 0;
+    int columns = 0;
+
+    is.read(reinterpret_cast<char*>(&rows), sizeof(int));
+    is.read(reinterpret_cast<char*>(&columns), sizeof(int));
+
+    FloatBuffer values;
+
+    readBufferFromStream(is, &values);
+
+    // Same order as writeSMToStream
+    int numNonZeroValueIndices = skipIntBufferInStream(is);
+    int numRowRanges = skipIntBufferInStream(is);
+    int numColumnIndices = skipIntBufferInStream(is);
+    int numColumnRanges = skipIntBufferInStream(is);
+    int numRowIndices = skipIntBufferInStream(is);
+
+    if (!is.good())
+        return;
+
+    mat.clearDirty();
+
+    topologyCache->initSMLocalRF(inSize, outSize, radius, numColumnRanges > 0, mat);
+
+    if (mat.rows != rows || mat.columns != columns || mat.nonZeroValues.size() != values.size() ||
+        mat.nonZeroValueIndices.size() != numNonZeroValueIndices || mat.rowRanges.size() != numRowRanges ||
+        mat.columnIndices.size() != numColumnIndices || mat.columnRanges.size() != numColumnRanges || mat.rowIndices.size() != numRowIndices) {
+        is.setstate(std::ios::failbit);
+
+        return;
+    }
+
+    mat.nonZeroValues.swap(values);
+}
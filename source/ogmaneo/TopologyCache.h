@@ -0,0 +1,86 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#pragma once
+
+#include "Helpers.h"
+
+#include <map>
+#include <array>
+
+namespace ogmaneo {
+// Stores local receptive field topologies (no weight values) so they can be reused across layers, models and processes
+class TopologyCache {
+public:
+    typedef std::array<int, 7> Key; // inSize, outSize, radius
+
+private:
+    std::map<Key, SparseMatrix> topologies; // Index arrays only, nonZeroValues is left empty
+
+public:
+    // Copy a topology into mat, generating and caching it if not present. Values are zero initialized.
+    // Safe to call from multiple OpenMP threads
+    void initSMLocalRF(
+        const Int3 &inSize, // Size of input field
+        const Int3 &outSize, // Size of output field
+        int radius, // Radius of output onto input
+        bool transpose, // Whether the transpose is also needed
+        SparseMatrix &mat // Matrix to fill
+    );
+
+    // Remove all topologies
+    void clear() {
+        topologies.clear();
+    }
+
+    // Number of cached topologies
+    int size() const {
+        return topologies.size();
+    }
+
+    // Whether a topology is cached
+    bool contains(
+        const Int3 &inSize,
+        const Int3 &outSize,
+        int radius
+    ) const {
+        return topologies.find(Key{ inSize.x, inSize.y, inSize.z, outSize.x, outSize.y, outSize.z, radius }) != topologies.end();
+    }
+
+    // Write to stream
+    void writeToStream(
+        std::ostream &os // Stream to write to
+    ) const;
+
+    // Read from stream, merges with already cached topologies
+    void readFromStream(
+        std::istream &is // Stream to read from
+    );
+};
+
+// Create a local receptive field matrix, through the compute system's topology cache if it has one
+void initSMLocalRF(
+    ComputeSystem &cs, // Compute system
+    const Int3 &inSize, // Size of input field
+    const Int3 &outSize, // Size of output field
+    int radius, // Radius of output onto input
+    bool transpose, // Whether to also generate the transpose
+    SparseMatrix &mat // Matrix to fill
+);
+
+// Read a matrix written by writeSMToStream. With a cache, only the values are taken from the stream and the
+// topology is copied from the cache (the stream is failed if they do not match). Without one, same as readSMFromStream
+void readLocalRFSMFromStream(
+    std::istream &is, // Stream to read from
+    const Int3 &inSize, // Size of input field
+    const Int3 &outSize, // Size of output field
+    int radius, // Radius of output onto input
+    TopologyCache* topologyCache, // Cache to take the topology from, may be null
+    SparseMatrix &mat // Matrix to read
+);
+} // namespace ogmaneo
@@ -0,0 +1,185 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#include "TraceRecorder.h"
+
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <cstring>
+
+using namespace ogmaneo;
+
+static std::atomic<int> traceRecorderIds(0);
+
+// Buffers this thread used last, one per recorder, avoids the lock on every event
+struct TraceThreadCache {
+    static const int numEntries = 8;
+
+    int recorderIDs[numEntries];
+    void* buffers[numEntries];
+    int next; // Entry replaced on the next miss (round robin)
+};
+
+static thread_local TraceThreadCache traceThreadCache = { { -1, -1, -1, -1, -1, -1, -1, -1 }, { nullptr }, 0 };
+
+TraceRecorder::TraceRecorder()
+:
+id(traceRecorderIds++),
+start(std::chrono::steady_clock::now()),
+maxEventsPerThread(1 << 20)
+{}
+
+TraceRecorder::ThreadBuffer* TraceRecorder::getThreadBuffer() {
+    for (int i = 0; i < TraceThreadCache::numEntries; i++) {
+        if (traceThreadCache.recorderIDs[i] == id)
+            return static_cast<ThreadBuffer*>(traceThreadCache.buffers[i]);
+    }
+
+    std::lock_guard<std::mutex> lock(buffersMutex);
+
+    std::thread::id self = std::this_thread::get_id();
+
+    ThreadBuffer* buffer = nullptr;
+
+    for (int i = 0; i < buffers.size(); i++) {
+        if (buffers[i]->owner == self) {
+            buffer = buffers[i].get();
+
+            break;
+        }
+    }
+
+    if (buffer == nullptr) {
+        buffers.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+
+        buffer = buffers.back().get();
+
+        buffer->owner = self;
+        buffer->dropped = 0;
+    }
+
+    int entry = traceThreadCache.next;
+
+    traceThreadCache.recorderIDs[entry] = id;
+    traceThreadCache.buffers[entry] = buffer;
+    traceThreadCache.next = (entry + 1) % TraceThreadCache::numEntries;
+
+    return buffer;
+}
+
+void TraceRecorder::record(
+    const char* name,
+    const char* category,
+    std::chrono::steady_clock::time_point begin,
+    std::chrono::steady_clock::time_point end,
+    int arg0,
+    int arg1
+) {
+    ThreadBuffer* buffer = getThreadBuffer();
+
+    if (buffer->events.size() >= maxEventsPerThread) {
+        buffer->dropped++;
+
+        return;
+    }
+
+    TraceEvent e;
+    e.name = name;
+    e.category = category;
+    e.begin = begin;
+    e.end = end;
+    e.arg0 = arg0;
+    e.arg1 = arg1;
+
+    buffer->events.push_back(e);
+}
+
+void TraceRecorder::clear() {
+    std::lock_guard<std::mutex> lock(buffersMutex);
+
+    for (int i = 0; i < buffers.size(); i++) {
+        buffers[i]->events.clear();
+        buffers[i]->dropped = 0;
+    }
+
+    start = std::chrono::steady_clock::now();
+}
+
+int TraceRecorder::getNumEvents() const {
+    int total = 0;
+
+    for (int i = 0; i < buffers.size(); i++)
+        total += buffers[i]->events.size();
+
+    return total;
+}
+
+long long TraceRecorder::getNumDropped() const {
+    long long total = 0;
+
+    for (int i = 0; i < buffers.size(); i++)
+        total += buffers[i]->dropped;
+
+    return total;
+}
+
+void TraceRecorder::writeChromeTrace(
+    std::ostream &os
+) const {
+    os << std::fixed << std::setprecision(3);
+
+    os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    bool first = true;
+
+    // Threads are numbered in order of their first event
+    for (int t = 0; t < buffers.size(); t++) {
+        if (!first)
+            os << ",";
+
+        first = false;
+
+        os << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << t << ",\"args\":{\"name\":\"thread " << t << "\"}}";
+
+        for (int i = 0; i < buffers[t]->events.size(); i++) {
+            const TraceEvent &e = buffers[t]->events[i];
+
+            // Microseconds
+            double ts = std::chrono::duration<double, std::micro>(e.begin - start).count();
+            double dur = std::chrono::duration<double, std::micro>(e.end - e.begin).count();
+
+            os << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"" << e.category << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << t
+                << ",\"ts\":" << ts << ",\"dur\":" << dur << ",\"args\":{";
+
+            if (std::strcmp(e.category, "layer") == 0)
+                os << "\"layer\":" << e.arg0 << ",\"index\":" << e.arg1;
+            else if (std::strcmp(e.category, "worker") == 0)
+                os << "\"teamThread\":" << e.arg0;
+            else
+                os << "\"x\":" << e.arg0 << ",\"y\":" << e.arg1;
+
+            os << "}}";
+        }
+    }
+
+    os << "\n]}\n";
+}
+
+bool TraceRecorder::writeChromeTraceToFile(
+    const std::string &name
+) const {
+    std::ofstream os(name, std::ios::binary);
+
+    if (!os.is_open())
+        return false;
+
+    writeChromeTrace(os);
+
+    return os.good();
+}
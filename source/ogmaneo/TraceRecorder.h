@@ -0,0 +1,92 @@
+// ----------------------------------------------------------------------------
+//  OgmaNeo
+//  Copyright(c) 2016-2020 Ogma Intelligent Systems Corp. All rights reserved.
+//
+//  This copy of OgmaNeo is licensed to you under the terms described
+//  in the OGMANEO_LICENSE.md file included in this distribution.
+// ----------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <ostream>
+
+namespace ogmaneo {
+// Timed span on one thread
+struct TraceEvent {
+    const char* name; // Must be a string literal (or otherwise outlive the recorder)
+    const char* category; // "launch", "worker" or "layer"
+    std::chrono::steady_clock::time_point begin;
+    std::chrono::steady_clock::time_point end;
+    int arg0; // Launches: extent x, workers: thread number in the team, layers: layer index
+    int arg1; // Launches: extent y, layers: predictor/actor index
+};
+
+// Records spans into one buffer per thread (threads only append to their own), exportable as Chrome trace JSON.
+// Enabled by pointing ComputeSystem::traceRecorder at one
+class TraceRecorder {
+private:
+    struct ThreadBuffer {
+        std::thread::id owner;
+        std::vector<TraceEvent> events;
+        long long dropped; // Events past maxEventsPerThread
+    };
+
+    int id; // Distinguishes recorders in per-thread caches
+
+    std::chrono::steady_clock::time_point start;
+
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    std::mutex buffersMutex; // Only taken when a thread's buffer is not in its cache
+
+    ThreadBuffer* getThreadBuffer();
+
+public:
+    int maxEventsPerThread; // Buffer limit, later events are dropped
+
+    TraceRecorder();
+
+    TraceRecorder(
+        const TraceRecorder &other
+    ) = delete;
+
+    const TraceRecorder &operator=(
+        const TraceRecorder &other
+    ) = delete;
+
+    // Record a span on the calling thread. Lock-free after the first call on a thread, as long as the thread
+    // records into at most 8 recorders (threads cache the buffers of the last 8), otherwise misses take a lock
+    void record(
+        const char* name, // Event name (string literal)
+        const char* category, // Event category (string literal)
+        std::chrono::steady_clock::time_point begin, // Span begin
+        std::chrono::steady_clock::time_point end, // Span end
+        int arg0 = 0, // First argument
+        int arg1 = 0 // Second argument
+    );
+
+    // Drop all events and restart the clock. Not safe while recording
+    void clear();
+
+    // Number of recorded events
+    int getNumEvents() const;
+
+    // Number of events dropped because a buffer was full
+    long long getNumDropped() const;
+
+    // Write as Chrome trace (JSON object format), viewable in Perfetto or chrome://tracing. Not safe while recording
+    void writeChromeTrace(
+        std::ostream &os // Stream to write to
+    ) const;
+
+    // Write a Chrome trace file
+    bool writeChromeTraceToFile(
+        const std::string &name // File name
+    ) const;
+};
+} // namespace ogmaneo